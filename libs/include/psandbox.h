@@ -22,17 +22,25 @@
 extern "C" {
 #endif
 
-#define HOLDER_SIZE 50
+#define HOLDER_SIZE 50 // at most the bits of PSandbox::holders_shared
+#define HOLDER_INLINE 4 // holders kept in the sandbox, the rest in its cold part
 #define DBUG_TRACE(A) clock_gettime(CLOCK_REALTIME, A)
 #define NSEC_PER_SEC 1000000000L
 #define MAX_TIME 500
+#define PENALTY_BATCH 8 // penalties a sandbox gives before they are reported
 
 #define HIGHEST_PRIORITY 2
 #define MID_PRIORITY 1
 #define LOW_PRIORITY 0
 
-enum enum_event_type { PREPARE, ENTER, HOLD, UNHOLD, UNHOLD_IN_QUEUE_PENALTY, COND_WAKE };
-enum enum_isolation_type { ABSOLUTE, RELATIVE, SCALABLE, ISOLATION_DEFAULT};
+// HOLD_SHARED/UNHOLD_SHARED mark a key held in shared (reader) mode. They are
+// tracked in userspace; the kernel only ever sees a shared release as UNHOLD.
+enum enum_event_type { PREPARE, ENTER, HOLD, UNHOLD, UNHOLD_IN_QUEUE_PENALTY, COND_WAKE,
+    HOLD_SHARED, UNHOLD_SHARED };
+// DEADLINE is emulated in userspace, see activate_psandbox_deadline; its
+// isolation_level is the deadline of a plain activate_psandbox, in us.
+enum enum_isolation_type { ABSOLUTE, RELATIVE, SCALABLE, ISOLATION_DEFAULT,
+    DEADLINE};
 enum enum_unbind_flag {
     UNBIND_LAZY           = 0x1,
     UNBIND_ACT_UNFINISHED = 0x2,
@@ -48,13 +56,18 @@ typedef struct sandboxEvent {
 
 typedef struct pSandbox PSandbox;
 
+typedef struct isolationRule {
+  enum enum_isolation_type type;
+  int isolation_level;
+  int priority;
+  int is_retro;
+}IsolationRule;
 
-typedef struct pSandbox {
-  long bid;  // sandbox id used by syscalls
-  long pid; // the thread that the perfSandbox is bound
 
-  size_t holders[HOLDER_SIZE];
-  int hold_resource;
+/// What few sandboxes ever need: the holders past HOLDER_INLINE and the
+/// TRACE_NUMBER syscall trace. Allocated on first use, see PSandbox::cold.
+typedef struct pSandboxCold {
+  size_t holders[HOLDER_SIZE - HOLDER_INLINE];
 
   //Debugger for tracing syscall number
   long step;
@@ -62,16 +75,53 @@ typedef struct pSandbox {
   long result[MAX_TIME];
   long count;
   long activity;
-  long sample_count;
+}PSandboxCold;
+
+typedef struct __attribute__((aligned(64))) pSandbox {
+  // The first cacheline is what every event of the sandbox touches.
+  long bid;  // sandbox id used by syscalls
+  long pid; // the thread that the perfSandbox is bound
+  IsolationRule rule;
+  long wait_time; // ns spent blocked in the psandbox primitives or between
+                  // PREPARE and ENTER
+  unsigned long holders_shared; // bit i is set if holders[i] is held shared
+  int hold_resource;
+  int holder_count; // keys in holders, inline and cold
   int is_sample;
-}PSandbox;
 
-typedef struct isolationRule {
-  enum enum_isolation_type type;
-  int isolation_level;
-  int priority;
-  int is_retro;
-}IsolationRule;
+  size_t holders[HOLDER_INLINE]; // then cold->holders
+  PSandboxCold *cold;  // NULL until needed
+  long sample_count;
+
+  long penalty_debt;  // ns of delay owed to others, see penalize_psandbox
+  long penalty_stamp; // CLOCK_MONOTONIC ns the debt last changed
+  size_t penalty_keys[PENALTY_BATCH]; // penalties given, not yet reported
+  long penalty_amounts[PENALTY_BATCH];
+
+  pid_t tid;               // the thread that last took a key
+  size_t waiting_on;       // the key between PREPARE and ENTER, 0 if none
+  long wait_start;         // ns, when it PREPAREd on waiting_on
+  int inherited_priority;  // priority lent by a waiter, 0 if none
+  int base_nice;           // nice value of tid before a waiter boosted it
+  int boost_nice;          // and the one it was boosted to
+  int boosted;
+
+  int slo_class;           // see psandbox_slo.h, the class + 1, 0 if none
+  int slo_level;           // the isolation_level the kernel was given
+  long slo_start;          // ns, when the current activity started
+  long slo_wait_start;     // wait_time when it started
+
+  long deadline;            // CLOCK_MONOTONIC ns the activity is due, 0 if none
+  long deadline_activities; // activities that had a deadline
+  long deadline_misses;     // and finished after it
+
+  int admission_class;      // see psandbox_admission.h, the class + 1
+  long admission_wait;      // wait_time at the last freeze
+
+  struct pSandbox *reap_next; // pending list of release_psandbox_deferred
+  size_t parked_key;          // retro mode: the key it is unbound under
+  struct pSandbox *parked_next;
+}PSandbox;
 
 /// @brief Create a performance sandbox
 /// @return The point to the performance sandbox.
@@ -82,31 +132,116 @@ int create_psandbox(IsolationRule rule);
 /// @return On success 1 is return
 int release_psandbox(int pid);
 
+/// @brief Release a performance sandbox in the background
+///
+/// The calling thread is done with the sandbox at once; the kernel release,
+/// the removal from the sandbox map and the free are left to a reaper thread
+/// that batches them.
+/// @param pid The performance sandbox to release.
+/// @return On success 1 is returned.
+int release_psandbox_deferred(int pid);
+
+/// @brief Wait until every sandbox passed to release_psandbox_deferred is gone
+void psandbox_reaper_flush();
+
 /// @brief Update an event to the performance p_sandbox
 /// @param event The event to notify the performance p_sandbox.
 /// @param p_sandbox The p_sandbox to notify
 /// @return On success 1 is returned.
 long int do_update_psandbox(size_t key, enum enum_event_type event_type, int is_lazy, int is_pass);
 
+/// The calling thread's sandbox, 0 if none, and whether the child of a
+/// fork() still has to respawn the forking thread's. Only for the check in
+/// update_psandbox; the initial-exec model makes reading it a plain load.
+extern __thread int psandbox_id __attribute__((tls_model("initial-exec")));
+extern int psandbox_respawn_pending;
+
 /// @brief Update an event to the performance p_sandbox
 /// @param event The event to notify the performance p_sandbox.
 /// @param p_sandbox The p_sandbox to notify
 /// @return On success 1 is returned.
 long inline int update_psandbox(size_t key, enum enum_event_type event_type) {
+  // A thread without a sandbox has nothing to report; it is told so without
+  // a call into the library.
+  if (!psandbox_id && !psandbox_respawn_pending)
+    return -1;
   return do_update_psandbox(key,event_type,false,false);
 }
 
 void activate_psandbox(int pid);
+
+/// @brief Activate a sandbox for an activity that is due in deadline ns
+///
+/// Keys contended between DEADLINE sandboxes go to the earliest deadline
+/// first. For sandboxes of any type, freeze_psandbox counts whether the
+/// deadline was met, see psandbox_deadline_stats.
+void activate_psandbox_deadline(int pid, long deadline);
+
+/// @brief Activities with a deadline so far, and how many missed it
+void psandbox_deadline_stats(long *activities, long *misses);
+
 void freeze_psandbox(int pid);
 int get_current_psandbox();
 int get_psandbox(size_t key);
 int find_holder(size_t key);
+
+/// @brief Penalize the sandbox holding key for the delay it caused
+///
+/// The holder owes penalty ns, which it serves as a delay at its next PREPARE,
+/// before it takes another lock, rather than the caller waiting any longer.
+/// The holder is found through an index of key holders kept from the first
+/// call on; keys taken before that are not found. The debt is bounded,
+/// each event serves at most a bounded part of it, and it is forgiven over
+/// time. The kernel learns of the penalties the caller gave at its next
+/// freeze_psandbox, in one batch.
+/// @param penalty The delay in ns.
+/// @param key The key the caller waited for.
 void penalize_psandbox(long int penalty,size_t key);
 
-/// The functions are to transfer psandbox ownership between threads
+/// @brief Turn priority inheritance on or off, off by default
+///
+/// When on, a sandbox that PREPAREs on a key held by a lower priority sandbox
+/// lends its priority to the holder, and to whatever holder that one waits
+/// for in turn, until they UNHOLD their last key. The holder's thread gets the
+/// waiter's nice value meanwhile, which needs CAP_SYS_NICE or RLIMIT_NICE
+/// when it lowers the nice value. Costs a lookup in the index of key holders
+/// at every PREPARE of a sandbox above LOW_PRIORITY; keys taken before it is
+/// turned on are not in the index.
+void psandbox_priority_inheritance(int enable);
+
+/// The functions are to transfer psandbox ownership between threads. In retro
+/// mode the kernel keeps every binding; unbind_psandbox then only takes the
+/// sandbox from the calling thread and parks it under key in the library, and
+/// bind_psandbox picks up the sandbox parked under key, or returns the
+/// kernel's current sandbox of the thread if there is none.
 int unbind_psandbox(size_t key, int pid, enum enum_unbind_flag flags);
 int bind_psandbox(size_t key);
 
+/// @brief The key a sandbox is unbound under while no thread runs it
+///
+/// Used by the library wherever a sandbox is parked and later picked up by
+/// id alone. Sandbox ids never collide with the addresses used as event keys.
+static inline size_t psandbox_park_key(int pid) {
+  return (size_t) pid;
+}
+
+/// @brief Switch the calling thread from sandbox from to sandbox to
+///
+/// from is parked under psandbox_park_key(from) and to, parked there before,
+/// becomes the thread's sandbox; either may be 0 for none. The kernel is only
+/// told at the thread's next call that needs the binding (an event, activate,
+/// freeze, bind, unbind, ...), so a sandbox switched in and out again without
+/// any of those costs no syscall. Until then from may still be bound to the
+/// thread in the kernel, so it must be switched back in on the same thread:
+/// this is meant for event loops whose connections stay on one thread.
+/// In retro mode, where the kernel never moves a binding, parking is done by
+/// the library as for unbind_psandbox, and the switch moves the library's
+/// bookkeeping (held keys, penalties, SLO and deadline accounting) to to; the
+/// kernel keeps charging the thread.
+/// @return On success 0 is returned, -1 if from is not the current sandbox
+/// or, in retro mode, to is not parked.
+int psandbox_switch(int from, int to);
+
 // Add sampling logic
 int record_psandbox();
 int get_sample_rate();
@@ -0,0 +1,219 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_HPP
+#define PSANDBOX_USERLIB_PSANDBOX_HPP
+
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_mutex.h"
+#include "psandbox_rwlock.h"
+
+// Header-only C++ front-end that pairs the C calls by scope: activate with
+// freeze, HOLD with UNHOLD, create with release. Everything is resolved at
+// compile time from the lock type and the backend policy; the wrappers make
+// exactly the calls the hand-written C code would and nothing else. Events
+// go through the inline update_psandbox, so on threads without a sandbox
+// they cost a thread-local load and no call into libpsandbox.
+
+namespace psandbox {
+
+/// Backend that forwards to libpsandbox.
+struct KernelPolicy {
+  static int create(IsolationRule rule) { return create_psandbox(rule); }
+  static void release(int id) { release_psandbox(id); }
+  static void activate(int id) { activate_psandbox(id); }
+  static void freeze(int id) { freeze_psandbox(id); }
+  static void update(size_t key, enum enum_event_type event) {
+    update_psandbox(key, event);
+  }
+  static int unbind(size_t key, int id, enum enum_unbind_flag flags) {
+    return unbind_psandbox(key, id, flags);
+  }
+  static int bind(size_t key) { return bind_psandbox(key); }
+  static int switch_to(int from, int to) { return psandbox_switch(from, to); }
+};
+
+/// Backend with every call compiled out. Locks are still taken.
+struct NullPolicy {
+  static int create(IsolationRule) { return 0; }
+  static void release(int) {}
+  static void activate(int) {}
+  static void freeze(int) {}
+  static void update(size_t, enum enum_event_type) {}
+  static int unbind(size_t, int, enum enum_unbind_flag) { return 0; }
+  static int bind(size_t) { return 0; }
+  static int switch_to(int, int) { return 0; }
+};
+
+#ifdef DISABLE_PSANDBOX
+typedef NullPolicy DefaultPolicy;
+#else
+typedef KernelPolicy DefaultPolicy;
+#endif
+
+/// How ScopedHold takes a lock. reports_events is true for the psandbox
+/// primitives, which emit their own events; for everything else ScopedHold
+/// emits PREPARE/ENTER/HOLD around the acquire and UNHOLD after the release.
+/// The primary template takes any type with lock() and unlock() members.
+template <class Lock>
+struct LockTraits {
+  static const bool reports_events = false;
+  static void lock(Lock &l) { l.lock(); }
+  static void unlock(Lock &l) { l.unlock(); }
+};
+
+template <>
+struct LockTraits<pthread_mutex_t> {
+  static const bool reports_events = false;
+  static void lock(pthread_mutex_t &l) { pthread_mutex_lock(&l); }
+  static void unlock(pthread_mutex_t &l) { pthread_mutex_unlock(&l); }
+};
+
+template <>
+struct LockTraits<psandbox_mutex_t> {
+  static const bool reports_events = true;
+  static void lock(psandbox_mutex_t &l) { psandbox_mutex_lock(&l); }
+  static void unlock(psandbox_mutex_t &l) { psandbox_mutex_unlock(&l); }
+};
+
+/// psandbox_rwlock_t is held exclusively; see ScopedSharedHold for readers.
+template <>
+struct LockTraits<psandbox_rwlock_t> {
+  static const bool reports_events = true;
+  static void lock(psandbox_rwlock_t &l) { psandbox_rwlock_wrlock(&l); }
+  static void unlock(psandbox_rwlock_t &l) { psandbox_rwlock_wrunlock(&l); }
+};
+
+template <class Lock, class Policy,
+          bool = LockTraits<Lock>::reports_events>
+struct HoldEvents {
+  static void acquire(Lock &l) {
+    size_t key = (size_t) &l;
+
+    Policy::update(key, PREPARE);
+    LockTraits<Lock>::lock(l);
+    Policy::update(key, ENTER);
+    Policy::update(key, HOLD);
+  }
+  static void release(Lock &l) {
+    LockTraits<Lock>::unlock(l);
+    Policy::update((size_t) &l, UNHOLD);
+  }
+};
+
+template <class Lock, class Policy>
+struct HoldEvents<Lock, Policy, true> {
+  static void acquire(Lock &l) { LockTraits<Lock>::lock(l); }
+  static void release(Lock &l) { LockTraits<Lock>::unlock(l); }
+};
+
+/// Holds a lock for the length of a scope, reporting it to the sandbox.
+template <class Lock, class Policy = DefaultPolicy>
+class ScopedHold {
+ public:
+  explicit ScopedHold(Lock &lock) : lock_(lock) {
+    HoldEvents<Lock, Policy>::acquire(lock_);
+  }
+  ~ScopedHold() { HoldEvents<Lock, Policy>::release(lock_); }
+
+ private:
+  ScopedHold(const ScopedHold &);
+  ScopedHold &operator=(const ScopedHold &);
+
+  Lock &lock_;
+};
+
+/// Holds a psandbox_rwlock_t in shared mode for the length of a scope.
+class ScopedSharedHold {
+ public:
+  explicit ScopedSharedHold(psandbox_rwlock_t &lock) : lock_(lock) {
+    psandbox_rwlock_rdlock(&lock_);
+  }
+  ~ScopedSharedHold() { psandbox_rwlock_rdunlock(&lock_); }
+
+ private:
+  ScopedSharedHold(const ScopedSharedHold &);
+  ScopedSharedHold &operator=(const ScopedSharedHold &);
+
+  psandbox_rwlock_t &lock_;
+};
+
+/// Owns a sandbox id and releases it when it goes out of scope.
+template <class Policy = DefaultPolicy>
+class SandboxHandle {
+ public:
+  SandboxHandle() : id_(-1) {}
+  explicit SandboxHandle(IsolationRule rule) : id_(Policy::create(rule)) {}
+  /// Take ownership of a sandbox created elsewhere.
+  explicit SandboxHandle(int id) : id_(id) {}
+  SandboxHandle(SandboxHandle &&other) : id_(other.id_) { other.id_ = -1; }
+  SandboxHandle &operator=(SandboxHandle &&other) {
+    if (this != &other) {
+      reset();
+      id_ = other.id_;
+      other.id_ = -1;
+    }
+    return *this;
+  }
+  ~SandboxHandle() { reset(); }
+
+  int id() const { return id_; }
+  bool valid() const { return id_ != -1; }
+
+  void activate() const { Policy::activate(id_); }
+  void freeze() const { Policy::freeze(id_); }
+
+  /// Unbind the sandbox from the calling thread under psandbox_park_key().
+  int park(enum enum_unbind_flag flags = UNBIND_NONE) const {
+    return Policy::unbind(psandbox_park_key(id_), id_, flags);
+  }
+  /// Bind a sandbox parked with park() to the calling thread.
+  int unpark() const { return Policy::bind(psandbox_park_key(id_)); }
+
+  /// Give up ownership without releasing.
+  int detach() {
+    int id = id_;
+
+    id_ = -1;
+    return id;
+  }
+  void reset() {
+    if (id_ != -1)
+      Policy::release(id_);
+    id_ = -1;
+  }
+
+ private:
+  SandboxHandle(const SandboxHandle &);
+  SandboxHandle &operator=(const SandboxHandle &);
+
+  int id_;
+};
+
+/// Activates a sandbox for the length of a scope and freezes it on exit.
+template <class Policy = DefaultPolicy>
+class ScopedActivation {
+ public:
+  explicit ScopedActivation(int id) : id_(id) { Policy::activate(id_); }
+  explicit ScopedActivation(const SandboxHandle<Policy> &handle)
+      : id_(handle.id()) {
+    Policy::activate(id_);
+  }
+  ~ScopedActivation() { Policy::freeze(id_); }
+
+ private:
+  ScopedActivation(const ScopedActivation &);
+  ScopedActivation &operator=(const ScopedActivation &);
+
+  int id_;
+};
+
+}  // namespace psandbox
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_HPP
@@ -0,0 +1,51 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_ADMISSION_H
+#define PSANDBOX_USERLIB_PSANDBOX_ADMISSION_H
+
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSANDBOX_ADMISSION_CLASSES 16
+
+/// Admission control on create_psandbox, per class of sandboxes sharing a
+/// rule. Each class counts its sandboxes in flight (created and not yet
+/// released) and samples the time its activities spent waiting on others,
+/// at every freeze_psandbox. As in CoDel, a class is overloaded once that
+/// delay has stayed above target for a whole interval, and no longer once it
+/// has stayed below for an interval. While overloaded, new sandboxes are
+/// admitted only up to the number in flight that, by Little's law, would wait
+/// about target. A rejected create_psandbox returns -1 with errno set to
+/// EAGAIN at once, without a syscall, so the caller can shed the request.
+
+/// @brief Turn admission control on
+/// @param target_ns The acceptable waiting time per activity, e.g. 5ms.
+/// @param interval_ns How long it may be exceeded before rejecting, e.g. 100ms.
+/// @param max_in_flight A hard limit of sandboxes per class, 0 for none.
+/// @return On success 0 is returned, -1 with errno set to EINVAL if target_ns
+/// or interval_ns is not positive or max_in_flight is negative.
+int psandbox_admission_enable(long target_ns, long interval_ns,
+                              int max_in_flight);
+
+/// @brief Turn admission control off; classes and counts are kept
+void psandbox_admission_disable();
+
+/// @brief Sandboxes of the rule's class created and rejected so far, both 0
+/// if no sandbox of the rule was created under admission control
+void psandbox_admission_stats(IsolationRule rule, long *admitted,
+                              long *rejected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_ADMISSION_H
@@ -0,0 +1,51 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_CLASS_H
+#define PSANDBOX_USERLIB_PSANDBOX_CLASS_H
+
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSANDBOX_CLASS_NAME 32  // longest class name, with the terminator
+
+/// Named rule classes loaded from a configuration file, so that call sites
+/// name a class and operators retune the isolation without a restart. One
+/// class per line, '#' starts a comment:
+///
+///     # name        type      level  priority  [retro]
+///     oltp_read     RELATIVE  30     2
+///     batch_report  SCALABLE  100    0
+///     admin         ABSOLUTE  10     1         retro
+///
+/// type is ABSOLUTE, RELATIVE, SCALABLE, DEFAULT or DEADLINE. The file is watched with
+/// inotify and reloaded when it is written or replaced; a file that does not
+/// parse leaves the classes as they were. Lookups take no lock: a reload
+/// builds a new table and swaps it in, and the old one is freed once no
+/// lookup can still be reading it.
+
+/// @brief Load the classes from path and reload them whenever it changes
+/// @return On success 0 is returned, -1 if the file can't be read or parsed.
+int psandbox_class_load(const char *path);
+
+/// @brief Look up the rule of a class
+/// @return 0 if the class exists, -1 otherwise.
+int psandbox_class_rule(const char *name, IsolationRule *rule);
+
+/// @brief Create a performance sandbox with the rule of a class
+/// @return The sandbox as for create_psandbox, -1 if there is no such class.
+int create_psandbox_class(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_CLASS_H
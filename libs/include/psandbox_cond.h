@@ -0,0 +1,65 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_COND_H
+#define PSANDBOX_USERLIB_PSANDBOX_COND_H
+
+#include <pthread.h>
+#include <time.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psandboxWaiter;
+
+/// A condition variable that reports waits (PREPARE/ENTER) and wake ups
+/// (COND_WAKE) on its own address. A signal wakes the waiter whose sandbox
+/// has the highest priority, and among equal priorities the one that has been
+/// delayed the most so far, instead of the oldest waiter.
+typedef struct psandboxCond {
+  pthread_mutex_t lock;  // protects the waiter queue
+  struct psandboxWaiter *waiters;
+} psandbox_cond_t;
+
+#define PSANDBOX_COND_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, NULL}
+
+/// @brief Initialize the condition variable
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_cond_init(psandbox_cond_t *cond);
+
+/// @brief Destroy the condition variable, which must have no waiters
+/// @return On success 0 is returned, EBUSY if threads still wait on it.
+int psandbox_cond_destroy(psandbox_cond_t *cond);
+
+/// @brief Atomically release mutex and wait for the condition to be signaled
+/// @param mutex The mutex protecting the condition, held by the caller.
+/// @return 0 once woken, with mutex held again.
+int psandbox_cond_wait(psandbox_cond_t *cond, pthread_mutex_t *mutex);
+
+/// @brief Like psandbox_cond_wait, but give up at abstime
+/// @param abstime The CLOCK_REALTIME deadline.
+/// @return 0 once woken, ETIMEDOUT if the deadline passed. In both cases mutex
+/// is held again.
+int psandbox_cond_timedwait(psandbox_cond_t *cond, pthread_mutex_t *mutex,
+                            const struct timespec *abstime);
+
+/// @brief Wake the most urgent waiter, if any
+/// @return Always 0
+int psandbox_cond_signal(psandbox_cond_t *cond);
+
+/// @brief Wake all waiters, the most urgent first
+/// @return Always 0
+int psandbox_cond_broadcast(psandbox_cond_t *cond);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_COND_H
@@ -0,0 +1,179 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_CORO_HPP
+#define PSANDBOX_USERLIB_PSANDBOX_CORO_HPP
+
+#include "psandbox.hpp"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+
+// Sandboxes for C++20 coroutines. The library binds a sandbox to a thread,
+// but a coroutine may suspend on one thread and resume on another, and one
+// thread runs many coroutines. SandboxPromise is a promise mix-in whose
+// await_transform wraps every co_await so that the coroutine's sandbox is
+// bound to the resuming thread before the coroutine continues.
+//
+// While suspended, a sandbox is parked under psandbox_park_key(). A
+// coroutine that may migrate parks its sandbox as it suspends. A
+// thread-affine coroutine leaves it bound and it is parked only when another
+// sandbox needs the thread, so consecutive resumes of the same sandbox on a
+// thread cost no bind/unbind at all. Sandboxes are switched in with
+// psandbox_switch, which only reaches the kernel once the sandbox emits an
+// event.
+
+namespace psandbox {
+
+/// The sandbox each thread has bound on behalf of coroutines, 0 if none.
+template <class Policy = DefaultPolicy>
+struct CoroContext {
+  static inline thread_local int bound = 0;
+
+  /// Bind id to the calling thread, parking whichever sandbox it has. A
+  /// coroutine must not run in any sandbox but its own, so it aborts if id
+  /// can be neither switched in nor bound, e.g. as it was never parked.
+  static void enter(int id) {
+    int got;
+
+    if (id <= 0 || bound == id)
+      return;
+    if (Policy::switch_to(bound, id) == 0) {
+      bound = id;
+      return;
+    }
+    park_bound();
+    got = Policy::bind(psandbox_park_key(id));
+    if (got != id) {
+      printf("Error: Can't bind sandbox %d to the coroutine, got %d\n", id, got);
+      std::abort();
+    }
+    bound = id;
+  }
+
+  /// Park the sandbox the calling thread has bound, if any.
+  static void park_bound() {
+    if (!bound)
+      return;
+    Policy::unbind(psandbox_park_key(bound), bound, UNBIND_NONE);
+    bound = 0;
+  }
+
+  /// Create a sandbox bound to the calling thread for use with adopt().
+  static int create(IsolationRule rule) {
+    int id;
+
+    park_bound();
+    id = Policy::create(rule);
+    if (id > 0)
+      bound = id;
+    return id;
+  }
+
+  /// Release a sandbox; it must be bound to the calling thread.
+  static void release(int id) {
+    if (bound == id)
+      bound = 0;
+    Policy::release(id);
+  }
+};
+
+/// co_await adopt(id) hands sandbox id, bound to the calling thread (for
+/// example by CoroContext::create), over to the awaiting coroutine.
+struct Adopt {
+  int id;
+  bool thread_affine;
+};
+
+inline Adopt adopt(int id, bool thread_affine = false) {
+  Adopt adopt = {id, thread_affine};
+  return adopt;
+}
+
+namespace detail {
+
+template <class A>
+decltype(auto) get_awaiter(A &&awaitable) {
+  if constexpr (requires { std::forward<A>(awaitable).operator co_await(); })
+    return std::forward<A>(awaitable).operator co_await();
+  else
+    return std::forward<A>(awaitable);
+}
+
+}  // namespace detail
+
+template <class Policy>
+class SandboxPromise;
+
+/// Wraps the awaiter of a co_await: the sandbox is parked before the inner
+/// await_suspend runs (the coroutine may be resumed elsewhere before it
+/// returns) unless the coroutine is thread-affine, and it is rebound on
+/// resume.
+template <class Awaiter, class Policy>
+class SandboxAwaiter {
+ public:
+  SandboxAwaiter(Awaiter &&awaiter, SandboxPromise<Policy> &promise)
+      : awaiter_(std::forward<Awaiter>(awaiter)), promise_(promise) {}
+
+  bool await_ready() { return awaiter_.await_ready(); }
+
+  template <class Promise>
+  auto await_suspend(std::coroutine_handle<Promise> handle) {
+    if (!promise_.thread_affine() &&
+        CoroContext<Policy>::bound == promise_.sandbox())
+      CoroContext<Policy>::park_bound();
+    return awaiter_.await_suspend(handle);
+  }
+
+  decltype(auto) await_resume() {
+    CoroContext<Policy>::enter(promise_.sandbox());
+    return awaiter_.await_resume();
+  }
+
+ private:
+  Awaiter awaiter_;
+  SandboxPromise<Policy> &promise_;
+};
+
+/// Promise mix-in. Derive the coroutine's promise_type from it; the
+/// coroutine then takes its sandbox with co_await adopt(id).
+template <class Policy = DefaultPolicy>
+class SandboxPromise {
+ public:
+  int sandbox() const { return sandbox_; }
+  bool thread_affine() const { return thread_affine_; }
+
+  std::suspend_never await_transform(Adopt adopt) {
+    sandbox_ = adopt.id;
+    thread_affine_ = adopt.thread_affine;
+    return std::suspend_never();
+  }
+
+  template <class A>
+  auto await_transform(A &&awaitable) {
+    typedef decltype(detail::get_awaiter(std::forward<A>(awaitable))) Awaiter;
+
+    return SandboxAwaiter<Awaiter, Policy>(
+        detail::get_awaiter(std::forward<A>(awaitable)), *this);
+  }
+
+ private:
+  int sandbox_ = 0;
+  bool thread_affine_ = false;
+};
+
+}  // namespace psandbox
+
+#endif  // __cpp_impl_coroutine
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_CORO_HPP
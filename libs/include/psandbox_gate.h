@@ -0,0 +1,61 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_GATE_H
+#define PSANDBOX_USERLIB_PSANDBOX_GATE_H
+
+#include <pthread.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct psandboxWaiter;
+
+/// An admission gate that lets at most capacity threads in at a time, in the
+/// style of srv_conc_enter_innodb/srv_conc_exit_innodb. A thread that can not
+/// enter sleeps on a futex instead of polling; on exit the slot is handed to
+/// exactly one waiter, chosen by sandbox priority and then by how much delay
+/// its sandbox has accumulated. The gate's address is the event key.
+typedef struct psandboxGate {
+  pthread_mutex_t lock;  // protects active and the waiter queue
+  int capacity;
+  int active;
+  struct psandboxWaiter *waiters;
+} psandbox_gate_t;
+
+#define PSANDBOX_GATE_INITIALIZER(capacity) \
+  {PTHREAD_MUTEX_INITIALIZER, capacity, 0, NULL}
+
+/// @brief Initialize the gate
+/// @param capacity The number of threads allowed in at the same time.
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_gate_init(psandbox_gate_t *gate, int capacity);
+
+/// @brief Destroy the gate, which must be empty
+/// @return On success 0 is returned, EBUSY if threads are inside or waiting.
+int psandbox_gate_destroy(psandbox_gate_t *gate);
+
+/// @brief Enter the gate, sleeping until a slot is handed over if it is full
+/// @return Always 0
+int psandbox_gate_enter(psandbox_gate_t *gate);
+
+/// @brief Enter the gate only if a slot is free and nobody is queued
+/// @return On success 0 is returned, EBUSY otherwise.
+int psandbox_gate_tryenter(psandbox_gate_t *gate);
+
+/// @brief Leave the gate and hand the slot to the most urgent waiter
+/// @return Always 0
+int psandbox_gate_exit(psandbox_gate_t *gate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_GATE_H
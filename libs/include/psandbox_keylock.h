@@ -0,0 +1,56 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_KEYLOCK_H
+#define PSANDBOX_USERLIB_PSANDBOX_KEYLOCK_H
+
+#include <stddef.h>
+#include <time.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Exclusive ownership of an event key, for code that guards a resource with
+/// a flag and a sleep-poll loop rather than with a lock of its own. The key
+/// needs no storage: waiters are queued in a table striped by key. On unlock
+/// the key is handed directly to one waiter, chosen by sandbox priority and
+/// then by how much delay its sandbox has accumulated, so released keys
+/// cause no thundering herd and waiters do not overtake each other.
+///
+/// The queues are fed by these calls, not by the PREPARE events of
+/// update_psandbox. A PREPARE only announces a wait that the caller then
+/// does its own way, polling a flag or taking another lock: the library
+/// can neither put that thread to sleep on a queue from inside the event
+/// nor hand it a key it never asks for, so an UNHOLD would wake a thread
+/// that is not waiting there. The calls here still emit PREPARE, ENTER and
+/// HOLD as such code would, so the kernel sees the same events.
+
+/// @brief Acquire key, sleeping until it is handed over if it is held
+/// @return Always 0
+int psandbox_key_lock(size_t key);
+
+/// @brief Acquire key only if nobody holds it
+/// @return On success 0 is returned, EBUSY otherwise.
+int psandbox_key_trylock(size_t key);
+
+/// @brief Acquire key, waiting until abstime at most
+/// @param abstime The CLOCK_REALTIME deadline.
+/// @return On success 0 is returned, ETIMEDOUT if the deadline passed.
+int psandbox_key_timedlock(size_t key, const struct timespec *abstime);
+
+/// @brief Release key and hand it to the most urgent waiter
+/// @return On success 0 is returned, EPERM if the key is not held.
+int psandbox_key_unlock(size_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_KEYLOCK_H
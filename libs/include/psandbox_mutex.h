@@ -0,0 +1,63 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_MUTEX_H
+#define PSANDBOX_USERLIB_PSANDBOX_MUTEX_H
+
+#include <pthread.h>
+#include <time.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// A pthread mutex that reports PREPARE/ENTER/HOLD/UNHOLD on its own address.
+/// An uncontended acquire only records the key in the holder table; the
+/// kernel is told about the lock only when some thread actually had to wait.
+typedef struct psandboxMutex {
+  pthread_mutex_t mutex;
+  int waiters;    // threads blocked (or about to block) on the mutex
+  int contended;  // the current owner waited, so the kernel saw the acquire
+} psandbox_mutex_t;
+
+#define PSANDBOX_MUTEX_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, 0, 0}
+
+/// @brief Initialize the mutex
+/// @param attr The pthread attributes, or NULL for the default mutex.
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_mutex_init(psandbox_mutex_t *mutex,
+                        const pthread_mutexattr_t *attr);
+
+/// @brief Destroy the mutex
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_mutex_destroy(psandbox_mutex_t *mutex);
+
+/// @brief Acquire the mutex, reporting events only if it has to wait
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_mutex_lock(psandbox_mutex_t *mutex);
+
+/// @brief Acquire the mutex if it is free. Never reports an event.
+/// @return On success 0 is returned, EBUSY if the mutex is held.
+int psandbox_mutex_trylock(psandbox_mutex_t *mutex);
+
+/// @brief Acquire the mutex, waiting until abstime at most
+/// @param abstime The CLOCK_REALTIME deadline, as for pthread_mutex_timedlock.
+/// @return On success 0 is returned, ETIMEDOUT if the deadline passed.
+int psandbox_mutex_timedlock(psandbox_mutex_t *mutex,
+                             const struct timespec *abstime);
+
+/// @brief Release the mutex, reporting UNHOLD only if it was contended
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_mutex_unlock(psandbox_mutex_t *mutex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_MUTEX_H
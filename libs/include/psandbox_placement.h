@@ -0,0 +1,47 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_PLACEMENT_H
+#define PSANDBOX_USERLIB_PSANDBOX_PLACEMENT_H
+
+#include <sched.h>  // cpu_set_t needs _GNU_SOURCE
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// CPU placement by priority. A few CPUs, all on one NUMA node, are
+/// reserved for sandboxes of a high enough priority: at activate_psandbox
+/// and bind_psandbox their thread is moved onto the reserved CPUs, and the
+/// thread of any other sandbox, or of a high priority one that owes a
+/// penalty (see penalize_psandbox), onto the rest.
+/// Each thread remembers where it was put, so the affinity syscall is only
+/// made when that changes, and a thread is moved onto the reserved CPUs at
+/// most once per PSANDBOX_PLACEMENT_HOLD_NS; moves off them are never held.
+
+#define PSANDBOX_PLACEMENT_HOLD_NS 1000000
+
+/// @brief Reserve CPUs for sandboxes of priority min_priority and above
+/// @param reserved_cpus How many; they are taken from the NUMA node with the
+/// most CPUs the process may run on, the highest numbered first.
+/// @return 0, or -1 if that node has too few CPUs or none would be left.
+int psandbox_placement_enable(int reserved_cpus, int min_priority);
+
+/// @brief Give the reserved CPUs back; threads return to their old CPUs
+/// at their next activate_psandbox or bind_psandbox
+void psandbox_placement_disable();
+
+/// @brief The CPUs currently reserved, none if placement is off
+void psandbox_placement_reserved(cpu_set_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_PLACEMENT_H
@@ -0,0 +1,48 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_POOL_H
+#define PSANDBOX_USERLIB_PSANDBOX_POOL_H
+
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSANDBOX_POOL_CLASSES 16  // distinct rules kept at the same time
+#define PSANDBOX_POOL_SIZE 64     // sandboxes kept per rule
+
+// A process-wide pool of sandboxes for servers that create one per
+// connection. psandbox_pool_put resets a sandbox and parks it under
+// psandbox_park_key() instead of releasing it; psandbox_pool_get binds a
+// parked sandbox with the same rule instead of creating one. A reuse costs one
+// unbind and one bind, against a create and a release that each go through
+// the kernel, calloc/free and the locked sandbox map.
+
+/// @brief Take a sandbox with the given rule, creating one if none is pooled
+/// A pooled sandbox that can't be bound is dropped from the pool, but not
+/// released, as it may still be in use elsewhere; a new one is created then.
+/// @return The id of a sandbox bound to the caller, as from create_psandbox.
+int psandbox_pool_get(IsolationRule rule);
+
+/// @brief Give a sandbox back to the pool instead of releasing it
+///
+/// The sandbox must be bound to the caller and frozen. It is released for
+/// real if it still holds keys or the pool is full.
+/// @return On success 1 is returned, as from release_psandbox.
+int psandbox_pool_put(int pid);
+
+/// @brief Release every pooled sandbox
+void psandbox_pool_drain();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_POOL_H
@@ -0,0 +1,60 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_QUEUE_H
+#define PSANDBOX_USERLIB_PSANDBOX_QUEUE_H
+
+#include <stddef.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct psandboxQueueCell {
+  size_t seq;
+  void *data;
+  int psandbox;  // the producer's sandbox, 0 if it had none
+} PSandboxQueueCell;
+
+/// A bounded lock-free multi-producer multi-consumer task queue that moves
+/// the producer's sandbox along with each task. Push unbinds the producer's
+/// sandbox under the address of the cell the task lands in, pop binds it on
+/// the consumer, so a handoff costs one unbind and one bind and nothing else.
+typedef struct psandboxQueue {
+  PSandboxQueueCell *cells;
+  size_t mask;
+  size_t enqueue_pos __attribute__((aligned(64)));
+  size_t dequeue_pos __attribute__((aligned(64)));
+} psandbox_queue_t;
+
+/// @brief Initialize the queue
+/// @param capacity The number of cells, a power of two.
+/// @return On success 0 is returned, EINVAL or ENOMEM otherwise.
+int psandbox_queue_init(psandbox_queue_t *queue, size_t capacity);
+
+/// @brief Free the cells of the queue
+void psandbox_queue_destroy(psandbox_queue_t *queue);
+
+/// @brief Add a task, handing the caller's sandbox (if any) over with it
+/// @return On success 0 is returned, EAGAIN if the queue is full. On success
+/// the calling thread no longer has a sandbox.
+int psandbox_queue_push(psandbox_queue_t *queue, void *data);
+
+/// @brief Take the oldest task and bind the sandbox that came with it
+///
+/// The caller must not have a sandbox bound, as with bind_psandbox.
+/// @param data Set to the task.
+/// @return On success 0 is returned, EAGAIN if the queue is empty.
+int psandbox_queue_pop(psandbox_queue_t *queue, void **data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_QUEUE_H
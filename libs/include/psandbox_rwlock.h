@@ -0,0 +1,85 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_RWLOCK_H
+#define PSANDBOX_USERLIB_PSANDBOX_RWLOCK_H
+
+#include <pthread.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSANDBOX_RWLOCK_SLOTS 16  // power of two, readers pick slot cpu % SLOTS
+#define PSANDBOX_CACHELINE 64
+
+typedef struct psandboxReaderSlot {
+  long readers;  // may go negative when a reader unlocks on another cpu
+} __attribute__((aligned(PSANDBOX_CACHELINE))) PSandboxReaderSlot;
+
+/// A reader/writer lock that keeps the reader count per cpu, so read-mostly
+/// locks do not bounce a shared cacheline between readers. Readers record the
+/// lock address as HOLD_SHARED, writers as HOLD. As with psandbox_mutex_t, the
+/// kernel only hears about the lock when a reader or writer had to wait.
+///
+/// A holder entry is per sandbox and lock, not per reader: every reader is in
+/// a sandbox of its own and takes one slot of it, marked shared, and a sandbox
+/// reading the lock again reuses its slot, so its first rdunlock drops it.
+/// The HOLDER_INLINE slots only overflow into the cold part for a sandbox
+/// that holds more than HOLDER_INLINE locks at once, as with any other key.
+typedef struct psandboxRwlock {
+  PSandboxReaderSlot slot[PSANDBOX_RWLOCK_SLOTS];
+  pthread_mutex_t writer_lock;  // serializes writers
+  int writer;         // futex word, 1 while a writer owns or drains the lock
+  int drain;          // futex word, bumped by readers leaving under a writer
+  int read_waiters;   // readers blocked behind a writer
+  int write_waiters;  // writers blocked behind another writer or readers
+  int contended;      // the current writer waited
+} psandbox_rwlock_t;
+
+#define PSANDBOX_RWLOCK_INITIALIZER \
+  {{{0}}, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0}
+
+/// @brief Initialize the lock
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_rwlock_init(psandbox_rwlock_t *rwlock);
+
+/// @brief Destroy the lock, which must be free
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_rwlock_destroy(psandbox_rwlock_t *rwlock);
+
+/// @brief Acquire the lock shared, waiting while a writer holds it
+/// @return Always 0
+int psandbox_rwlock_rdlock(psandbox_rwlock_t *rwlock);
+
+/// @brief Acquire the lock shared if no writer holds or waits for it
+/// @return On success 0 is returned, EBUSY otherwise.
+int psandbox_rwlock_tryrdlock(psandbox_rwlock_t *rwlock);
+
+/// @brief Release a shared hold
+/// @return Always 0
+int psandbox_rwlock_rdunlock(psandbox_rwlock_t *rwlock);
+
+/// @brief Acquire the lock exclusive, waiting for writers and readers to leave
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_rwlock_wrlock(psandbox_rwlock_t *rwlock);
+
+/// @brief Acquire the lock exclusive if it is free
+/// @return On success 0 is returned, EBUSY otherwise.
+int psandbox_rwlock_trywrlock(psandbox_rwlock_t *rwlock);
+
+/// @brief Release an exclusive hold
+/// @return On success 0 is returned, otherwise a pthread error number.
+int psandbox_rwlock_wrunlock(psandbox_rwlock_t *rwlock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_RWLOCK_H
@@ -0,0 +1,85 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_SHARED_H
+#define PSANDBOX_USERLIB_PSANDBOX_SHARED_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum enum_shared_state { SHARED_FREE, SHARED_CLAIMED, SHARED_ACTIVE,
+    SHARED_HANDOFF, SHARED_BINDING };
+
+typedef struct psandboxSharedSlot {
+  uint32_t state;       // enum_shared_state, over the pid of who set it
+  uint32_t generation;  // bumped on every handoff, part of the token
+  int pid;              // the sandbox
+  pid_t owner;          // the process that has it bound
+  IsolationRule rule;
+} __attribute__((aligned(64))) PSandboxSharedSlot;
+
+/// A registry of sandboxes in a named shared memory segment, for servers
+/// that are several processes: a prefork server's workers see each other's
+/// sandboxes, and a sandbox can move between processes, e.g. from a proxy to
+/// the worker that serves the request. Slots are claimed with a CAS on their
+/// state, so a process dying at any point never leaves anything locked;
+/// psandbox_registry_reap frees the slots of processes that are gone.
+typedef struct psandboxRegistry {
+  uint32_t capacity;
+  uint32_t magic;
+  PSandboxSharedSlot slots[];
+} PSandboxRegistry;
+
+/// @brief Open the registry, creating it if needed
+/// @param name The shm_open name, e.g. "/psandbox".
+/// @param capacity The number of slots if the registry is created, not 0.
+/// @return On success 0 is returned, -1 otherwise with errno set.
+int psandbox_registry_open(const char *name, unsigned int capacity);
+
+/// @brief Unmap the registry, removing the name as well if unlink is set
+void psandbox_registry_close(const char *name, int unlink);
+
+/// @brief Make a sandbox of this process visible in the registry
+/// @return On success 0 is returned, -1 if the registry is full.
+int psandbox_registry_add(int pid);
+
+/// @brief Remove a sandbox from the registry, e.g. before releasing it
+void psandbox_registry_remove(int pid);
+
+/// @brief Copy the registry entry of a sandbox of any process
+/// @return 0 if the sandbox is in the registry, -1 otherwise.
+int psandbox_registry_find(int pid, PSandboxSharedSlot *slot);
+
+/// @brief Free the slots of processes that exited without removing them
+///
+/// That is slots in any state: active ones of a dead owner, ones a process
+/// died claiming or binding, and handoffs whose issuing process is gone.
+/// @return The number of slots freed.
+int psandbox_registry_reap();
+
+/// @brief Unbind a registered sandbox from the calling thread for another
+/// process to pick up
+///
+/// The sandbox must not hold any keys, as they are addresses in this process.
+/// @return A token for psandbox_handoff_bind, 0 on failure.
+uint64_t psandbox_handoff_unbind(int pid);
+
+/// @brief Bind a sandbox handed off by another process to the calling thread
+/// @return The id of the sandbox, -1 if the token is stale or already used.
+int psandbox_handoff_bind(uint64_t token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_SHARED_H
@@ -0,0 +1,63 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_SLO_H
+#define PSANDBOX_USERLIB_PSANDBOX_SLO_H
+
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSANDBOX_SLO_CLASSES 16
+
+/// A class of sandboxes sharing a latency SLO: the 99th percentile of their
+/// activities (activate_psandbox to freeze_psandbox) should stay within the
+/// target. Instead of a hand-tuned isolation_level, the class's level is
+/// adjusted online within [min_level, max_level]: every window of samples it
+/// is lowered (stricter isolation) when the SLO is missed and the sandboxes
+/// spent a noticeable share of their time waiting on others, and raised when
+/// latency is well within the SLO. The gap between the two thresholds, a
+/// window of rest after every change and steps proportional to the error
+/// but capped keep it from oscillating. Sandboxes take the class's level at
+/// creation and again at every activate_psandbox. The kernel only takes a
+/// level at creation, so a live sandbox's new level is followed by the
+/// library (DEADLINE classes, pools, fork) and reaches the kernel when the
+/// sandbox is replaced: psandbox_pool_put releases the ones that fell behind
+/// rather than pooling them. The class stays with a sandbox across the pool.
+
+/// @brief Add a class of sandboxes
+/// @param rule The rule of the class; isolation_level is the starting level.
+/// @param slo_ns The target for the 99th percentile activity latency.
+/// @param min_level The strictest level the controller may choose.
+/// @param max_level The loosest level the controller may choose.
+/// @return The class, or -1 if there are PSANDBOX_SLO_CLASSES already.
+int psandbox_slo_class(IsolationRule rule, long slo_ns, int min_level,
+                       int max_level);
+
+/// @brief Create a sandbox with the current rule of the class
+/// @return The sandbox, as for create_psandbox.
+int create_psandbox_slo(int slo_class);
+
+/// @brief The rule the class currently gives its sandboxes
+IsolationRule psandbox_slo_rule(int slo_class);
+
+/// @brief Feed an activity of the class to the controller
+///
+/// Called by freeze_psandbox for sandboxes of the class; for activities
+/// measured elsewhere it can be called directly.
+/// @param latency The activity's latency in ns.
+/// @param interference The part of latency spent waiting on others, in ns.
+void psandbox_slo_observe(int slo_class, long latency, long interference);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_SLO_H
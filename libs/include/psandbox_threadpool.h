@@ -0,0 +1,78 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_THREADPOOL_H
+#define PSANDBOX_USERLIB_PSANDBOX_THREADPOOL_H
+
+#include <pthread.h>
+#include "psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*psandbox_task_fn)(void *arg);
+
+typedef struct psandboxTask {
+  struct psandboxTask *next;
+  psandbox_task_fn fn;
+  void *arg;
+  int psandbox;  // the submitter's sandbox, 0 if it had none
+  int priority;
+  long arrival;  // ns, submit time minus the sandbox's past wait_time
+} PSandboxTask;
+
+typedef struct psandboxWorker {
+  pthread_mutex_t lock;  // protects the task list and bound
+  PSandboxTask *head;
+  PSandboxTask *tail;
+  int bound;             // sandbox bound to the worker, 0 if none
+  pthread_t thread;
+  struct psandboxThreadpool *pool;
+} PSandboxWorker;
+
+/// A work-stealing thread pool in which the sandbox follows the task rather
+/// than the worker. Submitting a task parks the submitter's sandbox under
+/// psandbox_park_key(); the worker that runs the task binds it for the length
+/// of the task. A task submitted from inside a task inherits the running
+/// sandbox, and a worker keeps a sandbox bound across consecutive tasks of
+/// the same sandbox. Idle workers steal the most urgent task they can find,
+/// i.e. the one whose sandbox has the highest priority, then the one whose
+/// sandbox has been delayed the most.
+typedef struct psandboxThreadpool {
+  PSandboxWorker *workers;
+  int nworkers;
+  unsigned int next;  // round robin for submissions from outside the pool
+  int seq;            // futex word, bumped on every submission
+  int idle;           // workers sleeping on seq
+  int stop;
+} psandbox_threadpool_t;
+
+/// @brief Start a pool
+/// @param nworkers The number of worker threads, at least 1.
+/// @return On success 0 is returned, otherwise an error number, EINVAL for
+/// fewer than 1 worker.
+int psandbox_threadpool_init(psandbox_threadpool_t *pool, int nworkers);
+
+/// @brief Run the queued tasks to completion and stop the workers
+void psandbox_threadpool_destroy(psandbox_threadpool_t *pool);
+
+/// @brief Queue fn(arg) to run in the caller's sandbox
+///
+/// Called from outside the pool, the caller's sandbox is unbound and must be
+/// picked up again with bind_psandbox(psandbox_park_key(id)) once the work
+/// is done.
+/// @return On success 0 is returned, ENOMEM otherwise.
+int psandbox_threadpool_submit(psandbox_threadpool_t *pool,
+                               psandbox_task_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_THREADPOOL_H
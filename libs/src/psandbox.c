@@ -14,11 +14,16 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include "syscall.h"
 #include <signal.h>
 #include "hashmap.h"
+#include "psandbox_internal.h"
+#include "psandbox_slab.h"
+#include "../include/psandbox_slo.h"
 
 #define SYS_CREATE_PSANDBOX    436
 #define SYS_RELEASE_PSANDBOX 437
@@ -32,7 +37,11 @@
 #define SYS_BIND_PSANDBOX 447
 #define SYS_PENALIZE_EVENT 448
 
-static __thread int psandbox_id;
+__thread int psandbox_id __attribute__((tls_model("initial-exec")));
+// The sandbox the kernel has bound to this thread. It trails psandbox_id after
+// psandbox_switch until sync_binding catches it up.
+static __thread int kernel_psandbox_id;
+static __thread pid_t thread_tid; // cached gettid(), 0 until first needed
 
 //#define DISABLE_PSANDBOX
 #define IS_RETRO
@@ -44,35 +53,94 @@ struct hashmap_s  *psandbox_map = NULL;
 pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 //pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* state the child of a fork() picks up, see atfork_child */
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+static int map_stale = 0;       // psandbox_map still holds the parent's sandboxes
+int psandbox_respawn_pending = 0; // the forking thread had a sandbox
+static int fork_parent_id = 0;  // its id in the parent
+static int fork_child_id = -1;  // its replacement in the child
+static IsolationRule fork_rule;
+
+/* activities with a deadline, see activate_psandbox_deadline */
+static int deadline_enabled = 0;  // a DEADLINE sandbox exists
+static long deadline_activities = 0;
+static long deadline_misses = 0;
+
+static void register_atfork();
+
+/// Give the child of a fork() a sandbox of its own, with the rule of the one
+/// the forking thread had, the first time it uses the API.
+static inline void respawn_after_fork() {
+  if (__builtin_expect(psandbox_respawn_pending, 0))
+    create_psandbox(fork_rule);
+}
+
+/// The id the forking thread's sandbox goes by in the child.
+static inline int fork_translate(int pid) {
+  if (__builtin_expect(fork_parent_id == 0, 1) || pid != fork_parent_id)
+    return pid;
+  respawn_after_fork();
+  return fork_child_id;
+}
+
 
 #define TRACK_SYSCALL() do {\
   PSandbox* p_sandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0); \
-  if(!p_sandbox) {         \
+  if(!p_sandbox || !psandbox_cold(p_sandbox)) {         \
     printf("error the psandbox is none\n");     \
     break;                  \
   }                          \
-  p_sandbox->count++;\
-  long i = p_sandbox->count % p_sandbox->step;\
+  PSandboxCold* cold = p_sandbox->cold;\
+  cold->count++;\
+  long i = cold->count % cold->step;\
   if (i == 0) {\
-  if (p_sandbox->result[p_sandbox->count / p_sandbox->step] != 0)\
+  if (cold->result[cold->count / cold->step] != 0)\
       printf("error the result is there in %lu\n",i);\
     struct timespec current;\
     DBUG_TRACE(&current);\
-    p_sandbox->result[p_sandbox->count / p_sandbox->step] = time2ms(current) - p_sandbox->start_time; \
+    cold->result[cold->count / cold->step] = time2ms(current) - cold->start_time; \
   }\
 } while(0)\
 
+// Emit the out-of-line definition of the inline wrapper for C callers.
+extern long int update_psandbox(size_t key, enum enum_event_type event_type);
+
+/// Bring the kernel's binding of the thread in line with psandbox_id. Called
+/// before every syscall that acts on the thread's sandbox.
+static int sync_binding() {
+  if (kernel_psandbox_id == psandbox_id)
+    return 0;
+#ifndef IS_RETRO
+  if (kernel_psandbox_id &&
+      !syscall(SYS_UNBIND_PSANDBOX, psandbox_park_key(kernel_psandbox_id),
+               UNBIND_NONE)) {
+    printf("error: unbind fail for psandbox %d\n", kernel_psandbox_id);
+    return -1;
+  }
+  kernel_psandbox_id = 0;
+  if (psandbox_id &&
+      syscall(SYS_BIND_PSANDBOX, psandbox_park_key(psandbox_id)) == -1) {
+    printf("Error: Can't bind psandbox %d for the thread %ld\n", psandbox_id,
+           syscall(SYS_gettid));
+    psandbox_id = 0;
+    return -1;
+  }
+#endif
+  kernel_psandbox_id = psandbox_id;
+  return 0;
+}
+
+static long update_event(BoxEvent *event, int is_lazy) {
+  if (sync_binding())
+    return -1;
+  return syscall(SYS_UPDATE_EVENT, event, is_lazy);
+}
+
 int psandbox_manager_init() {
   return syscall(SYS_START_MANAGER,&stats_lock);
 }
 
-int create_psandbox(IsolationRule rule) {
-#ifdef DISABLE_PSANDBOX
-  return -1;
-#endif
-  long bid;
-  PSandbox *p_sandbox;
-
+IsolationRule normalize_rule(IsolationRule rule) {
   if(rule.type == ISOLATION_DEFAULT) {
     rule.type = SCALABLE;
     rule.isolation_level = 100;
@@ -81,53 +149,293 @@ int create_psandbox(IsolationRule rule) {
   }
 #ifdef IS_RETRO
   rule.is_retro = true;
-  bid = syscall(SYS_CREATE_PSANDBOX,rule.type,rule.isolation_level,rule.priority, true);
+#endif
+  return rule;
+}
+
+/// The rule the kernel enforces. It has no DEADLINE type; the deadlines are
+/// kept by the library, on top of the least restrictive kernel rule.
+static IsolationRule kernel_rule(IsolationRule rule) {
+  if (rule.type == DEADLINE) {
+    rule.type = SCALABLE;
+    rule.isolation_level = 100;
+  }
+  return rule;
+}
+
+_Static_assert(offsetof(PSandbox, holders) == 64,
+               "the hot fields of PSandbox outgrew their cacheline");
+
+static PSandbox *alloc_psandbox() {
+  return slab_alloc();
+}
+
+static void free_psandbox(PSandbox *p_sandbox) {
+  if (p_sandbox)
+    free(p_sandbox->cold);
+  slab_free(p_sandbox);
+}
+
+PSandboxCold *psandbox_cold(PSandbox *psandbox) {
+  PSandboxCold *cold = __atomic_load_n(&psandbox->cold, __ATOMIC_ACQUIRE);
+  PSandboxCold *expected = NULL;
+
+  if (cold)
+    return cold;
+  cold = (PSandboxCold *) calloc(1, sizeof(PSandboxCold));
+  if (!cold)
+    return NULL;
+  // Threads switching into the same sandbox may get here at once.
+  if (!__atomic_compare_exchange_n(&psandbox->cold, &expected, cold, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(cold);
+    cold = expected;
+  }
+  return cold;
+}
+
+#define HOLDER_BUCKETS 512 // buckets of the key -> holder index, a power of 2
+#define HOLDER_WAYS 8       // holders a bucket records, one cacheline
+
+/// Which sandboxes hold a key, for penalize_psandbox and priority inheritance
+/// to find them without going through every sandbox. A sandbox is recorded
+/// once in the bucket of each key it holds; a lookup checks the holders of
+/// the bucket. Kept only once one of the two is in use, so keys held before
+/// that, or while a bucket is full, are not found.
+typedef struct holderBucket {
+  PSandbox *holders[HOLDER_WAYS];
+} __attribute__((aligned(64))) HolderBucket;
+
+static HolderBucket holder_index[HOLDER_BUCKETS];
+static int holder_index_enabled = 0;
+
+static void unindex_holders(PSandbox *psandbox);
+static void print_psandbox(PSandbox *psandbox);
+
+#define PARKED_BUCKETS 256
+
+/// In retro mode the kernel never moves a binding, so the library keeps the
+/// sandboxes unbound under a key itself, for a bind of the key to pick up on
+/// any thread. A sandbox parked under its psandbox_park_key() is found through
+/// the sandbox map; only those parked under other keys, as by the queues, go
+/// in the table. Protected by stats_lock.
+static PSandbox *parked[PARKED_BUCKETS];
+
+static PSandbox **parked_bucket(size_t key) {
+  return &parked[(key * 0x9E3779B97F4A7C15UL) >> 56];
+}
+
+static int parked_in_table(PSandbox *psandbox) {
+  return psandbox->parked_key &&
+      psandbox->parked_key != psandbox_park_key((int) psandbox->pid);
+}
+
+#ifdef IS_RETRO
+static void park_psandbox(PSandbox *psandbox, size_t key) {
+  PSandbox **bucket = parked_bucket(key);
+
+  psandbox->parked_key = key;
+  if (parked_in_table(psandbox)) {
+    psandbox->parked_next = *bucket;
+    *bucket = psandbox;
+  }
+}
+
+/// @return The sandbox parked under key, taken off the table, or NULL
+static PSandbox *claim_parked(size_t key) {
+  PSandbox **pos, *psandbox;
+
+  if (key == (size_t) (int) key) {
+    psandbox = (PSandbox *) hashmap_get(psandbox_map, (int) key, 0);
+    if (psandbox && psandbox->parked_key == key && !parked_in_table(psandbox)) {
+      psandbox->parked_key = 0;
+      return psandbox;
+    }
+  }
+  for (pos = parked_bucket(key); (psandbox = *pos); pos = &psandbox->parked_next) {
+    if (psandbox->parked_key == key) {
+      *pos = psandbox->parked_next;
+      psandbox->parked_key = 0;
+      psandbox->parked_next = NULL;
+      return psandbox;
+    }
+  }
+  return NULL;
+}
+#endif
+
+/// Drop a sandbox that goes away from the parked table, if it is there.
+static void unpark_psandbox(PSandbox *psandbox) {
+  PSandbox **pos;
+
+  if (parked_in_table(psandbox)) {
+    for (pos = parked_bucket(psandbox->parked_key); *pos;
+         pos = &(*pos)->parked_next) {
+      if (*pos == psandbox) {
+        *pos = psandbox->parked_next;
+        break;
+      }
+    }
+  }
+  psandbox->parked_key = 0;
+}
+
+static void insert_psandbox(PSandbox *p_sandbox) {
+  pthread_mutex_lock(&stats_lock);
+  // After a fork, start over rather than free the parent's sandboxes, which
+  // would only copy the pages they share with the parent.
+  if (psandbox_map == NULL || map_stale) {
+    psandbox_map = (struct hashmap_s *)malloc(sizeof(struct hashmap_s));
+    hashmap_create(32, psandbox_map);
+    // The index may still point at the parent's sandboxes.
+    if (map_stale) {
+      memset(holder_index, 0, sizeof(holder_index));
+      memset(parked, 0, sizeof(parked));
+    }
+    map_stale = 0;
+  }
+  hashmap_put(psandbox_map, p_sandbox->pid, p_sandbox,0);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+PSandbox *adopt_psandbox(int pid, IsolationRule rule) {
+  PSandbox *p_sandbox = NULL;
+
+  if (psandbox_map && !map_stale)
+    p_sandbox = (PSandbox *) hashmap_get(psandbox_map, pid, 0);
+  if (p_sandbox)
+    return p_sandbox;
+  p_sandbox = alloc_psandbox();
+  if (!p_sandbox)
+    return NULL;
+  p_sandbox->pid = pid;
+  p_sandbox->rule = rule;
+  insert_psandbox(p_sandbox);
+  return p_sandbox;
+}
+
+void forget_psandbox(int pid) {
+  PSandbox *p_sandbox;
+
+  // Not unbound before, e.g. as the handoff's unbind failed.
+  if (pid == psandbox_id) {
+    psandbox_id = 0;
+    kernel_psandbox_id = 0;
+  }
+  if (!psandbox_map || map_stale)
+    return;
+  pthread_mutex_lock(&stats_lock);
+  p_sandbox = (PSandbox *) hashmap_get(psandbox_map, pid, 0);
+  if (p_sandbox) {
+    unindex_holders(p_sandbox);
+    unpark_psandbox(p_sandbox);
+    hashmap_remove(psandbox_map, pid);
+    admission_done(p_sandbox->admission_class);
+  }
+  pthread_mutex_unlock(&stats_lock);
+  free_psandbox(p_sandbox);
+}
+
+int create_psandbox(IsolationRule rule) {
+#ifdef DISABLE_PSANDBOX
+  return -1;
+#endif
+  long bid;
+  PSandbox *p_sandbox;
+  IsolationRule kernel;
+  int admitted = 0;
+
+  pthread_once(&atfork_once, register_atfork);
+  rule = normalize_rule(rule);
+  kernel = kernel_rule(rule);
+  if (__builtin_expect(admission_enabled, 0)) {
+    admitted = admission_admit(rule);
+    if (admitted < 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+  if (sync_binding()) {
+    admission_done(admitted);
+    return -1;
+  }
+#ifdef IS_RETRO
+  bid = syscall(SYS_CREATE_PSANDBOX,kernel.type,kernel.isolation_level,kernel.priority, true);
 #elif defined(NO_LIB)
-  bid = syscall(SYS_CREATE_PSANDBOX,rule.type,rule.isolation_level,rule.priority);
+  bid = syscall(SYS_CREATE_PSANDBOX,kernel.type,kernel.isolation_level,kernel.priority);
   return bid;
 #else
-  bid = syscall(SYS_CREATE_PSANDBOX,rule.type,rule.isolation_level,rule.priority,false);
+  bid = syscall(SYS_CREATE_PSANDBOX,kernel.type,kernel.isolation_level,kernel.priority,false);
 #endif
 
 //  bid = syscall(SYS_gettid);
   if (bid == -1) {
     printf("syscall failed with errno: %s\n", strerror(errno));
+    admission_done(admitted);
     return -1;
   }
-
-  if (psandbox_map == NULL) {
-    psandbox_map = (struct hashmap_s *)malloc(sizeof(struct hashmap_s));
-    hashmap_create(32, psandbox_map);
+  p_sandbox = alloc_psandbox();
+  if (!p_sandbox) {
+    printf("Error: Can't allocate sandbox %ld\n", bid);
+    syscall(SYS_RELEASE_PSANDBOX, bid);
+    admission_done(admitted);
+    errno = ENOMEM;
+    return -1;
   }
 
   psandbox_id = bid;
-  p_sandbox = (struct pSandbox *) calloc(sizeof(struct pSandbox),1);
+  kernel_psandbox_id = bid;
+  if (psandbox_respawn_pending) {
+    psandbox_respawn_pending = 0;
+    fork_child_id = bid;
+  }
   p_sandbox->pid = bid;
+  p_sandbox->rule = rule;
+  p_sandbox->admission_class = admitted;
+  if (rule.type == DEADLINE)
+    __atomic_store_n(&deadline_enabled, 1, __ATOMIC_RELAXED);
 
-  pthread_mutex_lock(&stats_lock);
-  hashmap_put(psandbox_map, bid, p_sandbox,0);
+  insert_psandbox(p_sandbox);
 //  printf("create psandbox %d\n",psandbox_id);
-  pthread_mutex_unlock(&stats_lock);
 #ifdef TRACE_NUMBER
-  p_sandbox->step = 10000;
+  PSandboxCold *cold = psandbox_cold(p_sandbox);
+  cold->step = 10000;
   struct timespec start;
   DBUG_TRACE(&start);
-  p_sandbox->start_time  = time2ms(start);
-  p_sandbox->count++;
-  p_sandbox->activity = 0;
+  cold->start_time  = time2ms(start);
+  cold->count++;
+  cold->activity = 0;
 #endif
   return bid;
 }
 
+/// The sandbox to release for pid: in the child of a fork(), the forking
+/// thread's sandbox is replaced by its respawned one, or by none (-1) if the
+/// child never used it.
+static int fork_release_id(int pid) {
+  if (__builtin_expect(fork_parent_id == 0, 1) || pid != fork_parent_id)
+    return pid;
+  fork_parent_id = 0;
+  if (psandbox_respawn_pending) {
+    psandbox_respawn_pending = 0;
+    return -1;
+  }
+  return fork_child_id;
+}
+
 int release_psandbox(int pid) {
+  PSandbox *psandbox;
   int success = 0;
 
   #ifdef DISABLE_PSANDBOX
   return -1;
   #endif
 
+  pid = fork_release_id(pid);
   if (pid == -1)
     return success;
+  if (sync_binding())
+    return -1;
 
 #ifdef NO_LIB
   success = (int) syscall(SYS_RELEASE_PSANDBOX, pid);
@@ -142,19 +450,222 @@ int release_psandbox(int pid) {
     return success;
   }
    #ifdef TRACE_NUMBER
-  print_all();
+  print_psandbox((PSandbox *) hashmap_get(psandbox_map, pid, 0));
   #endif
+  pthread_mutex_lock(&stats_lock);
+  psandbox = psandbox_map && !map_stale
+                 ? (PSandbox *) hashmap_get(psandbox_map, pid, 0) : NULL;
+  if (psandbox) {
+    admission_done(psandbox->admission_class);
+    psandbox->admission_class = 0;
+    unindex_holders(psandbox);
+    unpark_psandbox(psandbox);
+  }
   hashmap_remove(psandbox_map, pid);
+  pthread_mutex_unlock(&stats_lock);
+  free_psandbox(psandbox);
   psandbox_id = 0;
+  kernel_psandbox_id = 0;
 
 
   return success;
 }
 
+#define REAP_BATCH 64            // wake the reaper once this many are queued
+#define REAP_INTERVAL_NS 10000000 // otherwise it picks them up this often
+
+enum reaper_state { REAPER_BUSY, REAPER_NAPPING, REAPER_SLEEPING };
+
+/* sandboxes handed to the reaper by release_psandbox_deferred */
+static PSandbox *reap_list = NULL;
+static int reap_pending = 0;  // futex word, sandboxes not yet freed
+static int reap_seq = 0;      // futex word, bumped to wake the reaper
+static int reaper_state = REAPER_BUSY;
+static pthread_once_t reaper_once = PTHREAD_ONCE_INIT;
+
+/// Release a batch in the kernel, drop it from the map under a single
+/// stats_lock section and free it.
+static void reap(PSandbox *list) {
+  PSandbox *psandbox, *next;
+  int count = 0;
+
+  for (psandbox = list; psandbox; psandbox = psandbox->reap_next) {
+    if (syscall(SYS_RELEASE_PSANDBOX, psandbox->pid) == -1)
+      printf("failed to release sandbox in the kernel: %s\n", strerror(errno));
+#ifdef TRACE_NUMBER
+    print_psandbox(psandbox);
+#endif
+  }
+
+  pthread_mutex_lock(&stats_lock);
+  for (psandbox = list; psandbox; psandbox = psandbox->reap_next) {
+    unindex_holders(psandbox);
+    unpark_psandbox(psandbox);
+    hashmap_remove(psandbox_map, psandbox->pid);
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  for (psandbox = list; psandbox; psandbox = next) {
+    next = psandbox->reap_next;
+    free_psandbox(psandbox);
+    count++;
+  }
+  __atomic_sub_fetch(&reap_pending, count, __ATOMIC_SEQ_CST);
+  futex_wake(&reap_pending, INT_MAX);
+}
+
+static void wake_reaper() {
+  __atomic_add_fetch(&reap_seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&reap_seq, 1);
+}
+
+/// After a batch the reaper naps for REAP_INTERVAL_NS to let the next one
+/// build up, and only sleeps for good after a nap that brought nothing.
+static void *reaper_main(void *arg) {
+  struct timespec deadline;
+  PSandbox *list;
+  int napped = 0;
+  int seq;
+
+  (void) arg;
+  for (;;) {
+    seq = __atomic_load_n(&reap_seq, __ATOMIC_SEQ_CST);
+    list = __atomic_exchange_n(&reap_list, NULL, __ATOMIC_ACQUIRE);
+    if (list) {
+      reap(list);
+      napped = 0;
+      continue;
+    }
+    if (napped) {
+      __atomic_store_n(&reaper_state, REAPER_SLEEPING, __ATOMIC_SEQ_CST);
+      if (!__atomic_load_n(&reap_list, __ATOMIC_SEQ_CST))
+        futex_wait(&reap_seq, seq, NULL);
+    } else {
+      __atomic_store_n(&reaper_state, REAPER_NAPPING, __ATOMIC_SEQ_CST);
+      DBUG_TRACE(&deadline);
+      deadline = timeAdd(deadline, (Time) {.tv_sec = 0,
+                                           .tv_nsec = REAP_INTERVAL_NS});
+      futex_wait(&reap_seq, seq, &deadline);
+      napped = 1;
+    }
+    __atomic_store_n(&reaper_state, REAPER_BUSY, __ATOMIC_SEQ_CST);
+  }
+  return NULL;
+}
+
+static void start_reaper() {
+  pthread_attr_t attr;
+  pthread_t reaper;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&reaper, &attr, reaper_main, NULL))
+    printf("failed to start the psandbox reaper\n");
+  pthread_attr_destroy(&attr);
+}
+
+int release_psandbox_deferred(int pid) {
+  PSandbox *psandbox;
+  int pending, state;
+
+#ifdef DISABLE_PSANDBOX
+  return -1;
+#endif
+  pid = fork_release_id(pid);
+  if (pid == -1)
+    return 0;
+  pthread_mutex_lock(&stats_lock);
+  psandbox = psandbox_map && !map_stale
+                 ? (PSandbox *) hashmap_get(psandbox_map, pid, 0) : NULL;
+  if (psandbox) {
+    admission_done(psandbox->admission_class);
+    psandbox->admission_class = 0;
+  }
+  pthread_mutex_unlock(&stats_lock);
+  if (!psandbox)
+    return release_psandbox(pid);
+
+  // The thread is done with the sandbox now; the kernel drops its binding
+  // when the reaper releases it.
+  if (psandbox_id == pid)
+    psandbox_id = 0;
+  if (kernel_psandbox_id == pid)
+    kernel_psandbox_id = 0;
+
+  pthread_once(&reaper_once, start_reaper);
+  pending = __atomic_add_fetch(&reap_pending, 1, __ATOMIC_SEQ_CST);
+  psandbox->reap_next = __atomic_load_n(&reap_list, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&reap_list, &psandbox->reap_next,
+                                      psandbox, true, __ATOMIC_SEQ_CST,
+                                      __ATOMIC_RELAXED)) {
+  }
+  // A reaper that is about to sleep for good checks the list after
+  // announcing it; a napping one wakes up by itself.
+  state = __atomic_load_n(&reaper_state, __ATOMIC_SEQ_CST);
+  if (state == REAPER_SLEEPING ||
+      (state == REAPER_NAPPING && pending >= REAP_BATCH))
+    wake_reaper();
+  return 1;
+}
+
+void psandbox_reaper_flush() {
+  int pending;
+
+  if (__atomic_load_n(&reap_pending, __ATOMIC_SEQ_CST))
+    wake_reaper();
+  while ((pending = __atomic_load_n(&reap_pending, __ATOMIC_SEQ_CST)) != 0)
+    futex_wait(&reap_pending, pending, NULL);
+}
+
+static void atfork_prepare() {
+  pthread_mutex_lock(&stats_lock);
+}
+
+static void atfork_parent() {
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/// Runs in the child with only the forking thread left. Everything here is
+/// O(1): the parent's sandboxes are dropped from the map the next time a
+/// sandbox is created, and the forking thread's sandbox is only replaced if
+/// the child goes on to use it.
+static void atfork_child() {
+  PSandbox *psandbox = NULL;
+
+  pthread_mutex_init(&stats_lock, NULL);
+  slab_atfork_child();
+  if (psandbox_map) {
+    map_stale = 1;
+    if (psandbox_id)
+      psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
+  }
+  psandbox_respawn_pending = psandbox != NULL;
+  fork_parent_id = psandbox ? psandbox_id : 0;
+  fork_child_id = -1;
+  if (psandbox)
+    fork_rule = psandbox->rule;
+  psandbox_id = 0;
+  kernel_psandbox_id = 0;
+  thread_tid = 0;
+
+  // The reaper thread is gone; the sandboxes it had pending are the parent's.
+  reap_list = NULL;
+  reap_pending = 0;
+  reaper_state = REAPER_BUSY;
+  reaper_once = (pthread_once_t) PTHREAD_ONCE_INIT;
+}
+
+static void register_atfork() {
+  pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+}
+
 int get_current_psandbox() {
   #ifdef DISABLE_PSANDBOX
   return -1;
   #endif
+  respawn_after_fork();
+  if (sync_binding())
+    return -1;
   int pid = (int) syscall(SYS_GET_CURRENT_PSANDBOX);
 //  int bid = syscall(SYS_gettid);
 #ifdef TRACE_NUMBER
@@ -194,19 +705,43 @@ int unbind_psandbox(size_t key, int pid, enum enum_unbind_flag flags) {
   return -1;
 #endif
 
-#ifdef IS_RETRO
-  return 1;
-#endif
+  pid = fork_translate(pid);
   if (pid == -1) {
     printf("Error: Can't unbind sandbox for the thread %ld\n",syscall(SYS_gettid));
     return -1;
   }
+#ifdef IS_RETRO
+  // The kernel keeps the thread's binding; the library parks the sandbox for
+  // a bind of the key to pick up.
+  if (pid == psandbox_id) {
+    pthread_mutex_lock(&stats_lock);
+    if (psandbox_map && !map_stale) {
+      PSandbox *psandbox = (PSandbox *) hashmap_get(psandbox_map, pid, 0);
+
+      if (psandbox)
+        park_psandbox(psandbox, key);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    psandbox_id = 0;
+    kernel_psandbox_id = 0;
+  }
+  return 1;
+#endif
+  // Switched in but never bound in the kernel: it is still parked there.
+  if (pid == psandbox_id && kernel_psandbox_id != pid &&
+      key == psandbox_park_key(pid)) {
+    psandbox_id = 0;
+    return 0;
+  }
+  if (sync_binding())
+    return -1;
 
 #ifdef TRACE_NUMBER
   TRACK_SYSCALL();
 #endif
   if(syscall(SYS_UNBIND_PSANDBOX, key, flags)) {
     psandbox_id = 0;
+    kernel_psandbox_id = 0;
     return 0;
   }
 
@@ -215,6 +750,7 @@ int unbind_psandbox(size_t key, int pid, enum enum_unbind_flag flags) {
 }
 
 int bind_psandbox(size_t key) {
+  int bid;
 #ifdef DISABLE_PSANDBOX
   return -1;
 #endif
@@ -223,18 +759,350 @@ int bind_psandbox(size_t key) {
 #endif
 
 #ifdef IS_RETRO
-  return get_current_psandbox();
+  {
+    PSandbox *psandbox = NULL;
+
+    pthread_mutex_lock(&stats_lock);
+    if (psandbox_map && !map_stale)
+      psandbox = claim_parked(key);
+    pthread_mutex_unlock(&stats_lock);
+    if (psandbox) {
+      bid = (int) psandbox->pid;
+      psandbox_id = bid;
+      kernel_psandbox_id = bid;
+    } else {
+      // Nothing parked under key here: the kernel's binding is all there is.
+      bid = get_current_psandbox();
+    }
+  }
+  if (__builtin_expect(placement_enabled, 0))
+    placement_apply(psandbox_self());
+  return bid;
 #endif
-  int bid = (int) syscall(SYS_BIND_PSANDBOX, key);
+  if (sync_binding())
+    return -1;
+  bid = (int) syscall(SYS_BIND_PSANDBOX, key);
 
   if (bid == -1) {
     printf("Error: Can't bind address %ld for the thread %ld\n", key, syscall(SYS_gettid));
     return -1;
   }
   psandbox_id = bid;
+  kernel_psandbox_id = bid;
+  if (__builtin_expect(placement_enabled, 0))
+    placement_apply(psandbox_self());
   return bid;
 }
 
+int psandbox_switch(int from, int to) {
+#ifdef DISABLE_PSANDBOX
+  return -1;
+#endif
+  from = fork_translate(from);
+  to = fork_translate(to);
+  if (from != psandbox_id)
+    return -1;
+  if (from == to)
+    return 0;
+#ifdef IS_RETRO
+  // The kernel is never told; the library parks and picks up the sandboxes
+  // the way unbind_psandbox and bind_psandbox do.
+  {
+    PSandbox *psandbox = NULL;
+
+    pthread_mutex_lock(&stats_lock);
+    if (to && (!psandbox_map || map_stale ||
+               !(psandbox = claim_parked(psandbox_park_key(to))))) {
+      pthread_mutex_unlock(&stats_lock);
+      return -1;
+    }
+    if (from && psandbox_map && !map_stale &&
+        (psandbox = (PSandbox *) hashmap_get(psandbox_map, from, 0)))
+      park_psandbox(psandbox, psandbox_park_key(from));
+    pthread_mutex_unlock(&stats_lock);
+  }
+#endif
+  psandbox_id = to;
+  return 0;
+}
+
+int psandbox_self_id() {
+  respawn_after_fork();
+  return psandbox_id;
+}
+
+PSandbox *psandbox_self() {
+  respawn_after_fork();
+  if (psandbox_id == 0 || psandbox_map == NULL)
+    return NULL;
+  return (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
+}
+
+#define PI_MAX_CHAIN 8  // holders followed from one waiter
+
+static int priority_inheritance = 0;
+
+static pid_t current_tid() {
+  if (!thread_tid)
+    thread_tid = (pid_t) syscall(SYS_gettid);
+  return thread_tid;
+}
+
+void psandbox_priority_inheritance(int enable) {
+  if (enable)
+    __atomic_store_n(&holder_index_enabled, 1, __ATOMIC_RELAXED);
+  priority_inheritance = enable;
+}
+
+static int effective_priority(PSandbox *psandbox) {
+  return psandbox->inherited_priority > psandbox->rule.priority
+             ? psandbox->inherited_priority : psandbox->rule.priority;
+}
+
+static HolderBucket *holder_bucket(size_t key) {
+  return &holder_index[(key * 0x9E3779B97F4A7C15UL) >> 32 &
+                       (HOLDER_BUCKETS - 1)];
+}
+
+static int holds_key(PSandbox *psandbox, size_t key) {
+  int i, found = 0;
+
+  for (i = 0; i < HOLDER_SIZE && found < psandbox->holder_count; i++) {
+    size_t *slot = holder_slot(psandbox, i);
+
+    if (!slot)
+      break;
+    if (*slot == key)
+      return 1;
+    if (*slot)
+      found++;
+  }
+  return 0;
+}
+
+/// @return Whether the sandbox holds another key than key in its bucket
+static int holds_in_bucket(PSandbox *psandbox, HolderBucket *bucket,
+                           size_t key) {
+  int i, found = 0;
+
+  for (i = 0; i < HOLDER_SIZE && found < psandbox->holder_count; i++) {
+    size_t *slot = holder_slot(psandbox, i);
+
+    if (!slot)
+      break;
+    if (!*slot)
+      continue;
+    found++;
+    if (*slot != key && holder_bucket(*slot) == bucket)
+      return 1;
+  }
+  return 0;
+}
+
+static void index_holder(PSandbox *psandbox, size_t key) {
+  HolderBucket *bucket = holder_bucket(key);
+  PSandbox *expected;
+  int i;
+
+  for (i = 0; i < HOLDER_WAYS; i++) {
+    if (__atomic_load_n(&bucket->holders[i], __ATOMIC_RELAXED) == psandbox)
+      return;
+  }
+  for (i = 0; i < HOLDER_WAYS; i++) {
+    expected = NULL;
+    if (__atomic_compare_exchange_n(&bucket->holders[i], &expected, psandbox,
+                                    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+  }
+}
+
+static void unindex_holder(PSandbox *psandbox, HolderBucket *bucket) {
+  PSandbox *expected;
+  int i;
+
+  for (i = 0; i < HOLDER_WAYS; i++) {
+    expected = psandbox;
+    if (__atomic_compare_exchange_n(&bucket->holders[i], &expected, NULL, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return;
+  }
+}
+
+/// Drop a sandbox leaving the map from the index. Called with stats_lock
+/// held, so that lookups, which hold it too, never see a freed sandbox.
+static void unindex_holders(PSandbox *psandbox) {
+  int i, found = 0;
+
+  if (!__atomic_load_n(&holder_index_enabled, __ATOMIC_RELAXED))
+    return;
+  for (i = 0; i < HOLDER_SIZE && found < psandbox->holder_count; i++) {
+    size_t *slot = holder_slot(psandbox, i);
+
+    if (!slot)
+      break;
+    if (*slot) {
+      found++;
+      unindex_holder(psandbox, holder_bucket(*slot));
+    }
+  }
+}
+
+/// @return A sandbox other than skip holding key, NULL if there is none.
+/// Called with stats_lock held.
+static PSandbox *find_key_holder(size_t key, long skip) {
+  HolderBucket *bucket = holder_bucket(key);
+  PSandbox *holder;
+  int i;
+
+  if (psandbox_map == NULL || map_stale)
+    return NULL;
+  for (i = 0; i < HOLDER_WAYS; i++) {
+    holder = __atomic_load_n(&bucket->holders[i], __ATOMIC_ACQUIRE);
+    if (holder && holder->pid != skip && holds_key(holder, key))
+      return holder;
+  }
+  return NULL;
+}
+
+/// Lend the waiter's priority to the holder of key, then to the holder of
+/// the key that one waits for, and so on. Called with stats_lock held.
+static void inherit_priority(PSandbox *waiter, size_t key) {
+  int priority = effective_priority(waiter);
+  int nice, base, depth;
+  PSandbox *holder;
+
+  errno = 0;
+  nice = getpriority(PRIO_PROCESS, current_tid());
+  if (errno)
+    return;
+  for (depth = 0; depth < PI_MAX_CHAIN && key; depth++) {
+    holder = find_key_holder(key, waiter->pid);
+    if (!holder || effective_priority(holder) >= priority)
+      return;
+    if (!holder->boosted && holder->tid) {
+      errno = 0;
+      base = getpriority(PRIO_PROCESS, holder->tid);
+      if (!errno && base > nice &&
+          !setpriority(PRIO_PROCESS, holder->tid, nice)) {
+        holder->base_nice = base;
+        holder->boost_nice = nice;
+        holder->boosted = 1;
+      }
+    }
+    __atomic_store_n(&holder->inherited_priority, priority, __ATOMIC_RELAXED);
+    waiter = holder;
+    key = holder->waiting_on;
+  }
+}
+
+/// Give back a lent priority once the sandbox holds no key any more. The nice
+/// value is only put back if nobody changed it since the boost. Called with
+/// stats_lock held, as inherit_priority is, so a boost can't slip in between
+/// the last UNHOLD and this.
+static void restore_priority(PSandbox *psandbox) {
+  int nice;
+
+  if (!psandbox->inherited_priority || psandbox->holder_count)
+    return;
+  if (psandbox->boosted) {
+    errno = 0;
+    nice = getpriority(PRIO_PROCESS, psandbox->tid);
+    if (!errno && nice == psandbox->boost_nice)
+      setpriority(PRIO_PROCESS, psandbox->tid, psandbox->base_nice);
+  }
+  psandbox->boosted = 0;
+  psandbox->inherited_priority = 0;
+}
+
+/// Whether holders change under stats_lock: while priority inheritance is on
+/// or the sandbox still has a priority lent, so that boosts and restores see
+/// the holders of the sandbox as they are.
+static int lock_holders(PSandbox *psandbox) {
+  if (__builtin_expect(
+      !__atomic_load_n(&priority_inheritance, __ATOMIC_RELAXED) &&
+      !__atomic_load_n(&psandbox->inherited_priority, __ATOMIC_RELAXED), 1))
+    return 0;
+  pthread_mutex_lock(&stats_lock);
+  return 1;
+}
+
+static int record_holder(PSandbox *psandbox, size_t key, int shared);
+static int drop_holder(PSandbox *psandbox, size_t key);
+
+int add_holder(PSandbox *psandbox, size_t key, int shared) {
+  int locked = lock_holders(psandbox);
+  int success = record_holder(psandbox, key, shared);
+
+  if (locked)
+    pthread_mutex_unlock(&stats_lock);
+  return success;
+}
+
+int remove_holder(PSandbox *psandbox, size_t key) {
+  int locked = lock_holders(psandbox);
+  int success = drop_holder(psandbox, key);
+
+  if (locked) {
+    if (success)
+      restore_priority(psandbox);
+    pthread_mutex_unlock(&stats_lock);
+  }
+  return success;
+}
+
+static int record_holder(PSandbox *psandbox, size_t key, int shared) {
+  size_t *slot;
+  int i;
+  psandbox->tid = current_tid();
+  for (i = 0; i < HOLDER_SIZE ; ++i) {
+    slot = holder_slot(psandbox, i);
+    if (!slot) {
+      // Past the inline holders: the cold part is allocated on first use.
+      if (!psandbox_cold(psandbox))
+        break;
+      slot = holder_slot(psandbox, i);
+    }
+    if (*slot == 0 || *slot == key) {
+      if (*slot == 0)
+        psandbox->holder_count++;
+      *slot = key;
+      if (shared)
+        psandbox->holders_shared |= 1UL << i;
+      else
+        psandbox->holders_shared &= ~(1UL << i);
+      if (__atomic_load_n(&holder_index_enabled, __ATOMIC_RELAXED))
+        index_holder(psandbox, key);
+      return 1;
+    }
+  }
+
+  printf("can't create holder with malloc by psandbox %ld\n",psandbox->pid);
+  return 0;
+}
+
+static int drop_holder(PSandbox *psandbox, size_t key) {
+  size_t *slot;
+  int i;
+
+  if (!psandbox->holder_count)
+    return 0;
+  for (i = 0; i < HOLDER_SIZE ; ++i) {
+    slot = holder_slot(psandbox, i);
+    if (!slot)
+      break;
+    if (*slot == key) {
+      *slot = 0;
+      psandbox->holder_count--;
+      psandbox->holders_shared &= ~(1UL << i);
+      if (__atomic_load_n(&holder_index_enabled, __ATOMIC_RELAXED) &&
+          !holds_in_bucket(psandbox, holder_bucket(key), key))
+        unindex_holder(psandbox, holder_bucket(key));
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int find_holder(size_t key) {
   PSandbox *psandbox;
   int i;
@@ -243,13 +1111,126 @@ int find_holder(size_t key) {
   TRACK_SYSCALL();
 #endif
   for (i = 0; i < HOLDER_SIZE ; ++i) {
-    if (psandbox->holders[i] == key) {
+    size_t *slot = holder_slot(psandbox, i);
+
+    if (!slot)
+      break;
+    if (*slot == key) {
       return i;
     }
   }
   return -1;
 }
 
+#define PENALTY_MAX_DEBT 10000000L // ns a sandbox can owe at most
+#define PENALTY_MAX_DELAY 1000000L // ns served at one event at most
+#define PENALTY_FORGIVE_SHIFT 3    // 1 ns of debt forgiven per 8 ns elapsed
+
+static long monotonic_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static void charge_penalty(PSandbox *psandbox, long penalty, long now) {
+  long debt = __atomic_load_n(&psandbox->penalty_debt, __ATOMIC_RELAXED);
+
+  while (!__atomic_compare_exchange_n(
+      &psandbox->penalty_debt, &debt,
+      debt + penalty > PENALTY_MAX_DEBT ? PENALTY_MAX_DEBT : debt + penalty,
+      0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  __atomic_store_n(&psandbox->penalty_stamp, now, __ATOMIC_RELAXED);
+}
+
+/// Serve part of the debt of the calling thread's sandbox, after forgiving
+/// what the time since it last changed makes up for.
+static void serve_penalty(PSandbox *psandbox) {
+  struct timespec delay;
+  long debt, now, forgiven, served;
+
+  debt = __atomic_load_n(&psandbox->penalty_debt, __ATOMIC_RELAXED);
+  if (__builtin_expect(debt == 0, 1))
+    return;
+  now = monotonic_ns();
+  forgiven = (now - __atomic_load_n(&psandbox->penalty_stamp, __ATOMIC_RELAXED))
+      >> PENALTY_FORGIVE_SHIFT;
+  __atomic_store_n(&psandbox->penalty_stamp, now, __ATOMIC_RELAXED);
+  if (forgiven >= debt) {
+    __atomic_sub_fetch(&psandbox->penalty_debt, debt, __ATOMIC_RELAXED);
+    return;
+  }
+  served = debt - forgiven;
+  if (served > PENALTY_MAX_DELAY)
+    served = PENALTY_MAX_DELAY;
+  // Others only ever add to the debt, so it stays at least what was read.
+  __atomic_sub_fetch(&psandbox->penalty_debt, forgiven + served,
+                     __ATOMIC_RELAXED);
+  delay.tv_sec = served / NSEC_PER_SEC;
+  delay.tv_nsec = served % NSEC_PER_SEC;
+  while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+    ;
+}
+
+static void report_penalty(long penalty, size_t key) {
+  syscall(SYS_PENALIZE_EVENT, penalty, key);
+}
+
+/// Tell the kernel about the penalties the sandbox gave since the last time.
+static void report_penalties(PSandbox *psandbox) {
+  int i;
+
+  for (i = 0; i < PENALTY_BATCH && psandbox->penalty_keys[i]; i++) {
+    report_penalty(psandbox->penalty_amounts[i], psandbox->penalty_keys[i]);
+    psandbox->penalty_keys[i] = 0;
+    psandbox->penalty_amounts[i] = 0;
+  }
+}
+
+/// @return 1 if the penalty is queued for the next report, 0 if the batch is
+/// full
+static int queue_penalty(PSandbox *psandbox, long penalty, size_t key) {
+  int i;
+
+  for (i = 0; i < PENALTY_BATCH; i++) {
+    if (psandbox->penalty_keys[i] == 0 || psandbox->penalty_keys[i] == key) {
+      psandbox->penalty_keys[i] = key;
+      psandbox->penalty_amounts[i] += penalty;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void penalize_psandbox(long int penalty, size_t key) {
+  PSandbox *psandbox;
+  long now;
+
+#ifdef DISABLE_PSANDBOX
+  return;
+#endif
+  if (penalty <= 0 || psandbox_map == NULL)
+    return;
+
+  if (__builtin_expect(!holder_index_enabled, 0))
+    __atomic_store_n(&holder_index_enabled, 1, __ATOMIC_RELAXED);
+  now = monotonic_ns();
+  pthread_mutex_lock(&stats_lock);
+  psandbox = find_key_holder(key, psandbox_id);
+  if (psandbox)
+    charge_penalty(psandbox, penalty, now);
+  pthread_mutex_unlock(&stats_lock);
+
+  psandbox = psandbox_self();
+  if (!psandbox)
+    report_penalty(penalty, key);
+  else if (!queue_penalty(psandbox, penalty, key)) {
+    report_penalties(psandbox);
+    queue_penalty(psandbox, penalty, key);
+  }
+}
+
 
 long int do_update_psandbox(size_t key, enum enum_event_type event_type, int is_lazy, int is_pass) {
   long int success = 0;
@@ -270,6 +1251,7 @@ long int do_update_psandbox(size_t key, enum enum_event_type event_type, int is_
 
   event.key = key;
   event.event_type = event_type;
+  respawn_after_fork();
   if(psandbox_id == 0) {
     return -1;
   }
@@ -278,50 +1260,62 @@ long int do_update_psandbox(size_t key, enum enum_event_type event_type, int is_
 #endif
 
   switch (event_type) {
-    case HOLD: {
-      int i;
+    case HOLD:
+    case HOLD_SHARED: {
       psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
-      for (i = 0; i < HOLDER_SIZE ; ++i) {
-        if (psandbox->holders[i] == 0) {
-          psandbox->holders[i] = key;
-//          psandbox->hold_resource++;
-          break;
-        } else if (psandbox->holders[i] == key){
-          break;
-        }
-      }
-
-      if (i == HOLDER_SIZE){
-        printf("can't create holder with malloc by psandbox %ld\n",psandbox->pid);
+      if (psandbox)
+        add_holder(psandbox, key, event_type == HOLD_SHARED);
+      break;
+    }
+    case UNHOLD_SHARED: {
+      psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
+      if (psandbox && remove_holder(psandbox, key)) {
+        event.event_type = UNHOLD;
+        success = update_event(&event,is_lazy);
       }
-
       break;
     }
     case UNHOLD:
     case UNHOLD_IN_QUEUE_PENALTY: {
-      int i;
       if(is_lazy) {
-        success = syscall(SYS_UPDATE_EVENT,&event,is_lazy);
+        success = update_event(&event,is_lazy);
         break;
       }
       psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
-      for (i = 0; i < HOLDER_SIZE ; ++i) {
-        if (psandbox->holders[i] == key) {
-          psandbox->holders[i] = 0;
-//          psandbox->hold_resource--;
-//          if (psandbox->hold_resource == 0)
-          if (!is_pass)
-              success = syscall(SYS_UPDATE_EVENT,&event,is_lazy);
-          break;
+      if (psandbox && remove_holder(psandbox, key) && !is_pass)
+        success = update_event(&event,is_lazy);
+      if (is_pass)
+        success = update_event(&event,is_lazy);
+      break;
+    }
+    case PREPARE:
+    case ENTER: {
+      psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
+      if (psandbox) {
+        // Before the acquire: at ENTER the lock is held, and serving there
+        // would delay the very sandboxes that were owed.
+        if (event_type == PREPARE) {
+          serve_penalty(psandbox);
+          psandbox->wait_start = monotonic_ns();
+        } else if (psandbox->wait_start) {
+          // The primitives that do not queue through psandbox_waitq.c only
+          // show their waits here.
+          psandbox->wait_time += monotonic_ns() - psandbox->wait_start;
+          psandbox->wait_start = 0;
+        }
+        psandbox->waiting_on = event_type == PREPARE ? key : 0;
+        if (event_type == PREPARE && priority_inheritance &&
+            effective_priority(psandbox) > LOW_PRIORITY) {
+          pthread_mutex_lock(&stats_lock);
+          inherit_priority(psandbox, key);
+          pthread_mutex_unlock(&stats_lock);
         }
-
       }
-      if (is_pass)
-        success = syscall(SYS_UPDATE_EVENT,&event,is_lazy);
+      success = update_event(&event,is_lazy);
       break;
     }
     default:
-      success = syscall(SYS_UPDATE_EVENT,&event,is_lazy);
+      success = update_event(&event,is_lazy);
       break;
   }
 
@@ -415,7 +1409,9 @@ int get_psandbox_record() {
   return psandbox->sample_count;
 }
 
-void activate_psandbox(int pid) {
+static void start_activity(int pid, long deadline) {
+  PSandbox *psandbox;
+  long now;
 
   if (pid == -1) {
 //    printf("the active psandbox %lu is empty, the activity %p is empty\n", p_sandbox->pid, p_sandbox->activity);
@@ -424,15 +1420,63 @@ void activate_psandbox(int pid) {
 #ifdef DISABLE_PSANDBOX
   return ;
 #endif
+  respawn_after_fork();
 #ifdef TRACE_NUMBER
   TRACK_SYSCALL();
   PSandbox* p_sandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
-  p_sandbox->activity++;
+  if (p_sandbox && p_sandbox->cold)
+    p_sandbox->cold->activity++;
 #endif
+  if (__builtin_expect(slo_enabled || deadline_enabled || deadline, 0)) {
+    psandbox = psandbox_self();
+    if (psandbox) {
+      now = monotonic_ns();
+      if (psandbox->slo_class) {
+        // Follow the controller from the next activity on.
+        psandbox->rule.isolation_level =
+            psandbox_slo_rule(psandbox->slo_class - 1).isolation_level;
+        psandbox->slo_start = now;
+        psandbox->slo_wait_start = psandbox->wait_time;
+      }
+      if (!deadline && psandbox->rule.type == DEADLINE)
+        deadline = psandbox->rule.isolation_level * 1000L;
+      psandbox->deadline = deadline ? now + deadline : 0;
+    }
+  }
+  if (__builtin_expect(placement_enabled, 0))
+    placement_apply(psandbox_self());
+  if (sync_binding())
+    return;
   syscall(SYS_ACTIVATE_PSANDBOX);
 }
 
+void activate_psandbox(int pid) {
+  start_activity(pid, 0);
+}
+
+void activate_psandbox_deadline(int pid, long deadline) {
+  start_activity(pid, deadline > 0 ? deadline : 1);
+}
+
+void psandbox_deadline_stats(long *activities, long *misses) {
+  *activities = __atomic_load_n(&deadline_activities, __ATOMIC_RELAXED);
+  *misses = __atomic_load_n(&deadline_misses, __ATOMIC_RELAXED);
+}
+
+/// Count whether the activity that ends met its deadline.
+static void finish_deadline(PSandbox *psandbox) {
+  psandbox->deadline_activities++;
+  __atomic_add_fetch(&deadline_activities, 1, __ATOMIC_RELAXED);
+  if (monotonic_ns() > psandbox->deadline) {
+    psandbox->deadline_misses++;
+    __atomic_add_fetch(&deadline_misses, 1, __ATOMIC_RELAXED);
+  }
+  psandbox->deadline = 0;
+}
+
 void freeze_psandbox(int pid) {
+  PSandbox *psandbox;
+
 #ifdef TRACE_NUMBER
   TRACK_SYSCALL();
 #endif
@@ -446,16 +1490,43 @@ void freeze_psandbox(int pid) {
 #ifdef TRACE_NUMBER
   TRACK_SYSCALL();
 #endif
+  respawn_after_fork();
+  psandbox = psandbox_self();
+  if (psandbox) {
+    report_penalties(psandbox);
+    if (psandbox->slo_class && psandbox->slo_start) {
+      psandbox_slo_observe(psandbox->slo_class - 1,
+                           monotonic_ns() - psandbox->slo_start,
+                           psandbox->wait_time - psandbox->slo_wait_start);
+      psandbox->slo_start = 0;
+    }
+    if (psandbox->deadline)
+      finish_deadline(psandbox);
+    if (psandbox->admission_class) {
+      admission_sample(psandbox->admission_class,
+                       psandbox->wait_time - psandbox->admission_wait);
+      psandbox->admission_wait = psandbox->wait_time;
+    }
+  }
+  if (sync_binding())
+    return;
   syscall(SYS_FREEZE_PSANDBOX);
 }
 
-void print_all(){
+static void print_psandbox(PSandbox *psandbox){
+  PSandboxCold *cold;
   long i;
-  PSandbox *psandbox = (PSandbox *) hashmap_get(psandbox_map, psandbox_id, 0);
-  printf("Latency histogram (values are in nanoseconds) for pid %d\n",psandbox_id);
+  if (!psandbox || !psandbox->cold)
+    return;
+  cold = psandbox->cold;
+  printf("Latency histogram (values are in nanoseconds) for pid %ld\n",psandbox->pid);
   printf("value -- count\n");
-  printf("average number %lu\n",psandbox->count/psandbox->activity);
-  for (i = 0; i < (psandbox->count / psandbox->step); i++) {
-    printf("syscall: %lu | %u ms\n",(i)*psandbox->step,psandbox->result[i]);
+  printf("average number %lu\n",cold->count/cold->activity);
+  for (i = 0; i < (cold->count / cold->step); i++) {
+    printf("syscall: %lu | %ld ms\n",(i)*cold->step,cold->result[i]);
   }
 }
+
+void print_all() {
+  print_psandbox(psandbox_self());
+}
@@ -0,0 +1,178 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_admission.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include "psandbox_internal.h"
+#include "psandbox_waitq.h"
+
+typedef struct admissionClass {
+  IsolationRule rule;
+  int in_flight;
+  long admitted;
+  long rejected;
+  pthread_mutex_t lock;  // protects the CoDel state below
+  long above_until;      // ns the delay has to stay above target until, or 0
+  long below_until;      // the same for leaving the overload
+  int overloaded;
+  int limit;             // sandboxes in flight allowed while overloaded
+  int credit;            // samples below target since the limit last grew
+} AdmissionClass;
+
+int admission_enabled = 0;
+static long target = 0;
+static long interval = 0;
+static int max_in_flight = 0;
+static pthread_mutex_t class_lock = PTHREAD_MUTEX_INITIALIZER;
+static AdmissionClass classes[PSANDBOX_ADMISSION_CLASSES];
+static int class_count = 0;
+
+int psandbox_admission_enable(long target_ns, long interval_ns,
+                              int max_sandboxes) {
+  // update_limit divides by delays of at least target.
+  if (target_ns <= 0 || interval_ns <= 0 || max_sandboxes < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  target = target_ns;
+  interval = interval_ns;
+  max_in_flight = max_sandboxes;
+  __atomic_store_n(&admission_enabled, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void psandbox_admission_disable() {
+  __atomic_store_n(&admission_enabled, 0, __ATOMIC_RELEASE);
+}
+
+static int same_rule(IsolationRule a, IsolationRule b) {
+  return a.type == b.type && a.isolation_level == b.isolation_level &&
+      a.priority == b.priority && a.is_retro == b.is_retro;
+}
+
+/// @return The index of the rule's class, a new one if create is set, -1 if
+/// there is none or the classes are full
+static int find_class(IsolationRule rule, int create) {
+  int i, count = __atomic_load_n(&class_count, __ATOMIC_ACQUIRE);
+
+  for (i = 0; i < count; i++) {
+    if (same_rule(classes[i].rule, rule))
+      return i;
+  }
+  if (!create)
+    return -1;
+  pthread_mutex_lock(&class_lock);
+  for (i = 0; i < class_count; i++) {
+    if (same_rule(classes[i].rule, rule))
+      break;
+  }
+  if (i == class_count && i < PSANDBOX_ADMISSION_CLASSES) {
+    classes[i].rule = rule;
+    pthread_mutex_init(&classes[i].lock, NULL);
+    __atomic_store_n(&class_count, i + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&class_lock);
+  return i < PSANDBOX_ADMISSION_CLASSES ? i : -1;
+}
+
+int admission_admit(IsolationRule rule) {
+  AdmissionClass *cls;
+  int in_flight, index = find_class(rule, 1);
+
+  if (index == -1)
+    return 0;
+  cls = &classes[index];
+  in_flight = __atomic_load_n(&cls->in_flight, __ATOMIC_RELAXED);
+  if ((max_in_flight && in_flight >= max_in_flight) ||
+      (__atomic_load_n(&cls->overloaded, __ATOMIC_RELAXED) &&
+       in_flight >= __atomic_load_n(&cls->limit, __ATOMIC_RELAXED))) {
+    __atomic_add_fetch(&cls->rejected, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  __atomic_add_fetch(&cls->in_flight, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&cls->admitted, 1, __ATOMIC_RELAXED);
+  return index + 1;
+}
+
+void admission_done(int admission_class) {
+  if (admission_class > 0)
+    __atomic_sub_fetch(&classes[admission_class - 1].in_flight, 1,
+                       __ATOMIC_RELAXED);
+}
+
+/// While overloaded, the in-flight limit follows Little's law: with delay
+/// per activity at n in flight, n * target / delay would wait about target.
+/// Below target it only opens by one per limit samples, one more sandbox per
+/// round of activities; a class held to a single sandbox waits on nobody,
+/// which says nothing about how many more it takes.
+static void update_limit(AdmissionClass *cls, long delay) {
+  long in_flight = __atomic_load_n(&cls->in_flight, __ATOMIC_RELAXED);
+  long limit;
+
+  if (delay < target) {
+    if (++cls->credit < cls->limit)
+      return;
+    cls->credit = 0;
+    limit = cls->limit + 1;
+  } else {
+    cls->credit = 0;
+    // Halfway there per sample, so a single outlier does not close the class.
+    limit = (cls->limit + in_flight * target / delay) / 2;
+  }
+  __atomic_store_n(&cls->limit, limit < 1 ? 1 : (int) limit, __ATOMIC_RELAXED);
+}
+
+void admission_sample(int admission_class, long delay) {
+  AdmissionClass *cls;
+  long now;
+
+  if (admission_class <= 0)
+    return;
+  cls = &classes[admission_class - 1];
+  // The common case under no load changes nothing and takes no lock.
+  if (delay < target && !__atomic_load_n(&cls->above_until, __ATOMIC_RELAXED) &&
+      !__atomic_load_n(&cls->overloaded, __ATOMIC_RELAXED))
+    return;
+
+  now = waitq_now();
+  pthread_mutex_lock(&cls->lock);
+  if (cls->overloaded) {
+    // The limit follows the delay both ways, so it has opened up by the time
+    // the overload ends. Leaving takes an interval below target, or the
+    // class would flap with every activity that happened to be lucky.
+    update_limit(cls, delay);
+    if (delay >= target) {
+      cls->below_until = 0;
+    } else if (!cls->below_until) {
+      cls->below_until = now + interval;
+    } else if (now >= cls->below_until) {
+      cls->above_until = 0;
+      __atomic_store_n(&cls->overloaded, 0, __ATOMIC_RELAXED);
+    }
+  } else if (delay < target) {
+    cls->above_until = 0;
+  } else if (!cls->above_until) {
+    cls->above_until = now + interval;
+  } else if (now >= cls->above_until) {
+    cls->limit = __atomic_load_n(&cls->in_flight, __ATOMIC_RELAXED);
+    cls->below_until = 0;
+    cls->credit = 0;
+    update_limit(cls, delay);
+    __atomic_store_n(&cls->overloaded, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&cls->lock);
+}
+
+void psandbox_admission_stats(IsolationRule rule, long *admitted,
+                              long *rejected) {
+  int index = find_class(normalize_rule(rule), 0);
+
+  *admitted = index == -1 ? 0 : classes[index].admitted;
+  *rejected = index == -1 ? 0 : classes[index].rejected;
+}
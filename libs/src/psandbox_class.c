@@ -0,0 +1,328 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_class.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "psandbox_internal.h"
+
+#define CLASS_TABLE_MIN 16
+#define CLASS_FIELDS 5
+
+typedef struct classEntry {
+  char name[PSANDBOX_CLASS_NAME];  // empty if the slot is free
+  IsolationRule rule;
+} ClassEntry;
+
+/// An open addressing table, at most half full, never changed once published.
+typedef struct classTable {
+  unsigned int mask;
+  ClassEntry entries[];
+} ClassTable;
+
+static ClassTable *class_table = NULL;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static char class_path[PATH_MAX];
+static char class_file[NAME_MAX + 1];
+static int watch_fd = -1;
+
+/* lookups in flight, counted under the parity of the epoch they started in */
+static unsigned long rcu_epoch = 0;
+static long rcu_readers[2];
+
+static ClassTable *read_lock(int *parity) {
+  *parity = (int) (__atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST) & 1);
+  __atomic_add_fetch(&rcu_readers[*parity], 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&class_table, __ATOMIC_SEQ_CST);
+}
+
+static void read_unlock(int parity) {
+  __atomic_sub_fetch(&rcu_readers[parity], 1, __ATOMIC_RELEASE);
+}
+
+/// Wait until no lookup can see a table unpublished before the call. A lookup
+/// that picked its parity before a flip but counts itself after it reads the
+/// new table, and is waited for by the next reload's other phase.
+static void synchronize_readers() {
+  unsigned long epoch;
+  int phase;
+
+  for (phase = 0; phase < 2; phase++) {
+    epoch = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&rcu_readers[epoch & 1], __ATOMIC_SEQ_CST))
+      sched_yield();
+  }
+}
+
+static unsigned int hash_name(const char *name, size_t length) {
+  unsigned int hash = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static ClassEntry *find_entry(ClassTable *table, const char *name,
+                              size_t length) {
+  unsigned int i = hash_name(name, length) & table->mask;
+
+  while (table->entries[i].name[0]) {
+    if (strncmp(table->entries[i].name, name, length) == 0 &&
+        table->entries[i].name[length] == 0)
+      return &table->entries[i];
+    i = (i + 1) & table->mask;
+  }
+  return &table->entries[i];
+}
+
+static int parse_type(const char *token, enum enum_isolation_type *type) {
+  if (!strcmp(token, "ABSOLUTE"))
+    *type = ABSOLUTE;
+  else if (!strcmp(token, "RELATIVE"))
+    *type = RELATIVE;
+  else if (!strcmp(token, "SCALABLE"))
+    *type = SCALABLE;
+  else if (!strcmp(token, "DEFAULT"))
+    *type = ISOLATION_DEFAULT;
+  else if (!strcmp(token, "DEADLINE"))
+    *type = DEADLINE;
+  else
+    return -1;
+  return 0;
+}
+
+/// @return The number of fields of the line, split into fields
+static int split_line(char *line, char *fields[CLASS_FIELDS + 1]) {
+  char *save, *token;
+  int count = 0;
+
+  if ((token = strchr(line, '#')))
+    *token = 0;
+  for (token = strtok_r(line, " \t\r", &save); token && count <= CLASS_FIELDS;
+       token = strtok_r(NULL, " \t\r", &save))
+    fields[count++] = token;
+  return count;
+}
+
+static int parse_line(char *line, ClassTable *table, int number) {
+  char *fields[CLASS_FIELDS + 1], *end;
+  IsolationRule rule;
+  ClassEntry *entry;
+  int count = split_line(line, fields);
+
+  if (count == 0)
+    return 0;
+  if (count < 4 || count > CLASS_FIELDS ||
+      strlen(fields[0]) >= PSANDBOX_CLASS_NAME ||
+      parse_type(fields[1], &rule.type) ||
+      (count == CLASS_FIELDS && strcmp(fields[4], "retro")))
+    goto error;
+  rule.isolation_level = (int) strtol(fields[2], &end, 10);
+  if (*end)
+    goto error;
+  rule.priority = (int) strtol(fields[3], &end, 10);
+  if (*end || rule.priority < LOW_PRIORITY || rule.priority > HIGHEST_PRIORITY)
+    goto error;
+  rule.is_retro = count == CLASS_FIELDS;
+
+  entry = find_entry(table, fields[0], strlen(fields[0]));
+  strcpy(entry->name, fields[0]);
+  entry->rule = normalize_rule(rule);
+  return 0;
+
+error:
+  printf("Error: %s:%d: expected name type level priority [retro]\n",
+         class_path, number);
+  return -1;
+}
+
+/// @return The classes in the file, NULL if it can't be read or parsed
+static ClassTable *parse_file(const char *path) {
+  char line[LINE_MAX];
+  ClassTable *table;
+  const char *data = NULL;
+  unsigned int size = CLASS_TABLE_MIN;
+  struct stat st;
+  size_t i, start, lines = 0;
+  int fd, number = 0, failed = 0;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &st)) {
+    printf("Error: Can't read the sandbox classes in %s\n", path);
+    if (fd != -1)
+      close(fd);
+    return NULL;
+  }
+  if (st.st_size) {
+    data = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return NULL;
+    }
+  }
+  close(fd);
+
+  for (i = 0; i < (size_t) st.st_size; i++)
+    lines += data[i] == '\n';
+  while (size < 2 * (lines + 1))
+    size *= 2;
+  table = (ClassTable *) calloc(1, sizeof(ClassTable) + size * sizeof(ClassEntry));
+  if (table) {
+    table->mask = size - 1;
+    for (start = 0; start < (size_t) st.st_size && !failed; start = i + 1) {
+      for (i = start; i < (size_t) st.st_size && data[i] != '\n'; i++) {
+      }
+      number++;
+      if (i - start >= sizeof(line)) {
+        failed = 1;
+        break;
+      }
+      memcpy(line, data + start, i - start);
+      line[i - start] = 0;
+      failed = parse_line(line, table, number);
+    }
+  }
+  if (data)
+    munmap((void *) data, st.st_size);
+  if (failed) {
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+static int reload_classes() {
+  ClassTable *table, *old;
+
+  pthread_mutex_lock(&reload_lock);
+  table = parse_file(class_path);
+  if (!table) {
+    pthread_mutex_unlock(&reload_lock);
+    return -1;
+  }
+  old = __atomic_exchange_n(&class_table, table, __ATOMIC_SEQ_CST);
+  synchronize_readers();
+  pthread_mutex_unlock(&reload_lock);
+  free(old);
+  return 0;
+}
+
+static void *watch_main(void *arg) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+  ssize_t length;
+  char *p;
+  int changed;
+
+  for (;;) {
+    length = read(watch_fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      if (length == -1 && errno == EINTR)
+        continue;
+      break;
+    }
+    changed = 0;
+    for (p = buffer; p < buffer + length;
+         p += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *) p;
+      if (event->len && !strcmp(event->name, class_file))
+        changed = 1;
+    }
+    if (changed)
+      reload_classes();
+  }
+  return arg;
+}
+
+/// Watch the directory rather than the file: editors and deployment tools
+/// replace the file by renaming a new one over it.
+static int start_watch() {
+  char directory[PATH_MAX];
+  pthread_t thread;
+
+  strcpy(directory, class_path);
+  watch_fd = inotify_init1(IN_CLOEXEC);
+  if (watch_fd == -1)
+    return -1;
+  if (inotify_add_watch(watch_fd, dirname(directory),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) == -1 ||
+      pthread_create(&thread, NULL, watch_main, NULL)) {
+    close(watch_fd);
+    watch_fd = -1;
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+int psandbox_class_load(const char *path) {
+  char file[PATH_MAX];
+
+  if (strlen(path) >= PATH_MAX)
+    return -1;
+  pthread_mutex_lock(&reload_lock);
+  if (watch_fd != -1 && strcmp(path, class_path)) {
+    printf("Error: The sandbox classes are loaded from %s already\n",
+           class_path);
+    pthread_mutex_unlock(&reload_lock);
+    return -1;
+  }
+  strcpy(class_path, path);
+  strcpy(file, path);
+  strncpy(class_file, basename(file), NAME_MAX);
+  pthread_mutex_unlock(&reload_lock);
+
+  if (reload_classes())
+    return -1;
+  pthread_mutex_lock(&reload_lock);
+  if (watch_fd == -1 && start_watch())
+    printf("Error: Can't watch %s, its classes won't be reloaded\n", path);
+  pthread_mutex_unlock(&reload_lock);
+  return 0;
+}
+
+int psandbox_class_rule(const char *name, IsolationRule *rule) {
+  ClassTable *table;
+  ClassEntry *entry;
+  int parity, found = -1;
+
+  if (strlen(name) >= PSANDBOX_CLASS_NAME)
+    return -1;
+  table = read_lock(&parity);
+  if (table) {
+    entry = find_entry(table, name, strlen(name));
+    if (entry->name[0]) {
+      *rule = entry->rule;
+      found = 0;
+    }
+  }
+  read_unlock(parity);
+  return found;
+}
+
+int create_psandbox_class(const char *name) {
+  IsolationRule rule;
+
+  if (psandbox_class_rule(name, &rule)) {
+    printf("Error: No sandbox class %s\n", name);
+    return -1;
+  }
+  return create_psandbox(rule);
+}
@@ -0,0 +1,86 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_cond.h"
+
+#include <errno.h>
+#include "psandbox_waitq.h"
+
+int psandbox_cond_init(psandbox_cond_t *cond) {
+  cond->waiters = NULL;
+  return pthread_mutex_init(&cond->lock, NULL);
+}
+
+int psandbox_cond_destroy(psandbox_cond_t *cond) {
+  if (cond->waiters)
+    return EBUSY;
+  return pthread_mutex_destroy(&cond->lock);
+}
+
+int psandbox_cond_timedwait(psandbox_cond_t *cond, pthread_mutex_t *mutex,
+                            const struct timespec *abstime) {
+  size_t key = (size_t) cond;
+  PSandboxWaiter waiter;
+  int ret;
+
+  waiter_init(&waiter);
+  pthread_mutex_lock(&cond->lock);
+  waitq_insert(&cond->waiters, &waiter);
+  pthread_mutex_unlock(&cond->lock);
+
+  // Queued before the mutex is dropped, so a signal sent right after the
+  // unlock can not be lost.
+  pthread_mutex_unlock(mutex);
+  update_psandbox(key, PREPARE);
+  ret = waiter_sleep(&waiter, abstime);
+  if (ret == ETIMEDOUT) {
+    pthread_mutex_lock(&cond->lock);
+    // A signal that raced with the timeout has already popped us; consume it
+    // rather than losing the wake up.
+    if (!waitq_remove(&cond->waiters, &waiter))
+      ret = 0;
+    pthread_mutex_unlock(&cond->lock);
+  }
+  update_psandbox(key, ENTER);
+
+  pthread_mutex_lock(mutex);
+  return ret;
+}
+
+int psandbox_cond_wait(psandbox_cond_t *cond, pthread_mutex_t *mutex) {
+  return psandbox_cond_timedwait(cond, mutex, NULL);
+}
+
+int psandbox_cond_signal(psandbox_cond_t *cond) {
+  PSandboxWaiter *waiter;
+
+  pthread_mutex_lock(&cond->lock);
+  waiter = waitq_pop(&cond->waiters);
+  if (waiter)
+    waiter_wake(waiter);
+  pthread_mutex_unlock(&cond->lock);
+
+  if (waiter)
+    update_psandbox((size_t) cond, COND_WAKE);
+  return 0;
+}
+
+int psandbox_cond_broadcast(psandbox_cond_t *cond) {
+  PSandboxWaiter *waiter;
+  int woken = 0;
+
+  pthread_mutex_lock(&cond->lock);
+  while ((waiter = waitq_pop(&cond->waiters))) {
+    waiter_wake(waiter);
+    woken++;
+  }
+  pthread_mutex_unlock(&cond->lock);
+
+  if (woken)
+    update_psandbox((size_t) cond, COND_WAKE);
+  return 0;
+}
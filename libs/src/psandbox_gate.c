@@ -0,0 +1,97 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_gate.h"
+
+#include <errno.h>
+#include "psandbox_waitq.h"
+
+int psandbox_gate_init(psandbox_gate_t *gate, int capacity) {
+  gate->capacity = capacity;
+  gate->active = 0;
+  gate->waiters = NULL;
+  return pthread_mutex_init(&gate->lock, NULL);
+}
+
+int psandbox_gate_destroy(psandbox_gate_t *gate) {
+  if (gate->active || gate->waiters)
+    return EBUSY;
+  return pthread_mutex_destroy(&gate->lock);
+}
+
+static inline int try_admit(psandbox_gate_t *gate) {
+  // Queued waiters go first, otherwise a stream of newcomers could starve
+  // them even though exits hand slots over.
+  if (gate->active < gate->capacity && !gate->waiters) {
+    gate->active++;
+    return 1;
+  }
+  return 0;
+}
+
+static inline void hold_local(psandbox_gate_t *gate) {
+  PSandbox *psandbox = psandbox_self();
+
+  if (psandbox)
+    add_holder(psandbox, (size_t) gate, false);
+}
+
+int psandbox_gate_enter(psandbox_gate_t *gate) {
+  size_t key = (size_t) gate;
+  PSandboxWaiter waiter;
+
+  pthread_mutex_lock(&gate->lock);
+  if (try_admit(gate)) {
+    pthread_mutex_unlock(&gate->lock);
+    hold_local(gate);
+    return 0;
+  }
+  waiter_init(&waiter);
+  waitq_insert(&gate->waiters, &waiter);
+  pthread_mutex_unlock(&gate->lock);
+
+  update_psandbox(key, PREPARE);
+  // The exiting thread keeps active as is and hands us its slot.
+  waiter_sleep(&waiter, NULL);
+  update_psandbox(key, ENTER);
+  update_psandbox(key, HOLD);
+  return 0;
+}
+
+int psandbox_gate_tryenter(psandbox_gate_t *gate) {
+  int admitted;
+
+  pthread_mutex_lock(&gate->lock);
+  admitted = try_admit(gate);
+  pthread_mutex_unlock(&gate->lock);
+  if (!admitted)
+    return EBUSY;
+  hold_local(gate);
+  return 0;
+}
+
+int psandbox_gate_exit(psandbox_gate_t *gate) {
+  PSandboxWaiter *waiter;
+  PSandbox *psandbox;
+
+  pthread_mutex_lock(&gate->lock);
+  waiter = waitq_pop(&gate->waiters);
+  if (waiter)
+    waiter_wake(waiter);
+  else
+    gate->active--;
+  pthread_mutex_unlock(&gate->lock);
+
+  if (waiter) {
+    update_psandbox((size_t) gate, UNHOLD);
+  } else {
+    psandbox = psandbox_self();
+    if (psandbox)
+      remove_holder(psandbox, (size_t) gate);
+  }
+  return 0;
+}
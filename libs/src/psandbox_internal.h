@@ -0,0 +1,109 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Helpers shared between the translation units of libpsandbox. They are not
+// part of the public API in psandbox.h and may change at any time.
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_INTERNAL_H
+#define PSANDBOX_USERLIB_PSANDBOX_INTERNAL_H
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../include/psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief The id of the sandbox bound to the calling thread, 0 if none
+int psandbox_self_id();
+
+/// @brief Look up the sandbox bound to the calling thread without a syscall
+/// @return The sandbox, or NULL if the thread has none
+PSandbox *psandbox_self();
+
+/// @brief The rule create_psandbox actually applies for rule
+IsolationRule normalize_rule(IsolationRule rule);
+
+/// @brief Add a sandbox created by another process to the sandbox map
+/// @return The entry for pid, an existing one if there is one.
+PSandbox *adopt_psandbox(int pid, IsolationRule rule);
+
+/// @brief Drop a sandbox that moved to another process from the sandbox map,
+/// and from the calling thread if it is the thread's sandbox
+void forget_psandbox(int pid);
+
+/// Set once a class is added in psandbox_slo.c, so that activate_psandbox
+/// and freeze_psandbox only time activities when somebody wants them.
+extern int slo_enabled;
+
+/// Set while admission control is on, see psandbox_admission.c.
+extern int admission_enabled;
+
+/// @brief Admit a new sandbox of the rule's class
+/// @return The class + 1 to record in the sandbox, 0 if the class is not
+/// tracked, -1 if the sandbox is rejected.
+int admission_admit(IsolationRule rule);
+
+/// @brief A sandbox admitted into the class is gone
+void admission_done(int admission_class);
+
+/// @brief An activity of the class waited delay ns on others
+void admission_sample(int admission_class, long delay);
+
+/// Set once placement is enabled in psandbox_placement.c.
+extern int placement_enabled;
+
+/// @brief Move the calling thread to the CPUs for its sandbox, if it moved
+void placement_apply(PSandbox *psandbox);
+
+/// @brief The cold part of the sandbox, allocated on first use
+/// @return The cold part, NULL if it can't be allocated
+PSandboxCold *psandbox_cold(PSandbox *psandbox);
+
+/// @brief The i-th holder slot of the sandbox
+/// @return The slot, NULL if it is in a cold part not allocated yet
+static inline size_t *holder_slot(PSandbox *psandbox, int i) {
+  PSandboxCold *cold;
+
+  if (i < HOLDER_INLINE)
+    return &psandbox->holders[i];
+  cold = __atomic_load_n(&psandbox->cold, __ATOMIC_ACQUIRE);
+  return cold ? &cold->holders[i - HOLDER_INLINE] : NULL;
+}
+
+/// @brief Record that the sandbox holds key, without notifying the kernel
+/// @param shared Whether the key is held in shared (reader) mode.
+/// @return 1 if the key is recorded, 0 if the holder table is full
+int add_holder(PSandbox *psandbox, size_t key, int shared);
+
+/// @brief Forget that the sandbox holds key, without notifying the kernel
+/// @return 1 if the key was held, 0 otherwise
+int remove_holder(PSandbox *psandbox, size_t key);
+
+/// @brief Sleep while *uaddr == val, until abstime (CLOCK_REALTIME) if given
+static inline long futex_wait(int *uaddr, int val,
+                              const struct timespec *abstime) {
+  return syscall(SYS_futex, uaddr,
+                 FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG |
+                     (abstime ? FUTEX_CLOCK_REALTIME : 0),
+                 val, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/// @brief Wake up to count threads sleeping on uaddr
+static inline long futex_wake(int *uaddr, int count) {
+  return syscall(SYS_futex, uaddr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count,
+                 NULL, NULL, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_INTERNAL_H
@@ -0,0 +1,159 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_keylock.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include "psandbox_waitq.h"
+
+#define KEY_STRIPES 256
+
+typedef struct keyEntry {
+  struct keyEntry *next;
+  size_t key;
+  int contended;  // the holder waited, so the kernel saw the acquire
+  PSandboxWaiter *waiters;
+} KeyEntry;
+
+/// A key is held while it has an entry. Entries of released keys are kept
+/// for reuse, so a stripe allocates only as many as keys held at once.
+typedef struct keyStripe {
+  pthread_mutex_t lock;  // protects the entries and their waiter queues
+  KeyEntry *entries;
+  KeyEntry *spare;
+} __attribute__((aligned(64))) KeyStripe;
+
+static KeyStripe stripes[KEY_STRIPES] = {
+    [0 ... KEY_STRIPES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL}};
+
+static inline KeyStripe *stripe_of(size_t key) {
+  // Keys are mostly addresses; drop the alignment bits before mixing.
+  return &stripes[((key >> 4) * 0x9E3779B97F4A7C15UL) >> 56];
+}
+
+static KeyEntry **find_entry(KeyStripe *stripe, size_t key) {
+  KeyEntry **pos = &stripe->entries;
+
+  while (*pos && (*pos)->key != key) {
+    pos = &(*pos)->next;
+  }
+  return pos;
+}
+
+/// @return The new entry of key, or NULL if out of memory
+static KeyEntry *add_entry(KeyStripe *stripe, size_t key) {
+  KeyEntry *entry = stripe->spare;
+
+  if (entry)
+    stripe->spare = entry->next;
+  else if (!(entry = (KeyEntry *) malloc(sizeof(KeyEntry))))
+    return NULL;
+  entry->key = key;
+  entry->contended = 0;
+  entry->waiters = NULL;
+  entry->next = stripe->entries;
+  stripe->entries = entry;
+  return entry;
+}
+
+static inline void hold_local(size_t key) {
+  PSandbox *psandbox = psandbox_self();
+
+  if (psandbox)
+    add_holder(psandbox, key, false);
+}
+
+static int lock_key(size_t key, const struct timespec *abstime, int try) {
+  KeyStripe *stripe = stripe_of(key);
+  PSandboxWaiter waiter;
+  KeyEntry *entry;
+  int ret, queued;
+
+  pthread_mutex_lock(&stripe->lock);
+  entry = *find_entry(stripe, key);
+  if (!entry) {
+    entry = add_entry(stripe, key);
+    pthread_mutex_unlock(&stripe->lock);
+    if (!entry)
+      return ENOMEM;
+    hold_local(key);
+    return 0;
+  }
+  if (try) {
+    pthread_mutex_unlock(&stripe->lock);
+    return EBUSY;
+  }
+  waiter_init(&waiter);
+  waitq_insert(&entry->waiters, &waiter);
+  pthread_mutex_unlock(&stripe->lock);
+
+  update_psandbox(key, PREPARE);
+  ret = waiter_sleep(&waiter, abstime);
+  if (ret == ETIMEDOUT) {
+    pthread_mutex_lock(&stripe->lock);
+    queued = waitq_remove(&entry->waiters, &waiter);
+    pthread_mutex_unlock(&stripe->lock);
+    // Not queued any more: the key was handed over as the deadline passed.
+    if (queued) {
+      update_psandbox(key, ENTER);
+      return ETIMEDOUT;
+    }
+  }
+  // The releasing thread left the entry in place and marked it contended.
+  update_psandbox(key, ENTER);
+  update_psandbox(key, HOLD);
+  return 0;
+}
+
+int psandbox_key_lock(size_t key) {
+  return lock_key(key, NULL, 0);
+}
+
+int psandbox_key_trylock(size_t key) {
+  return lock_key(key, NULL, 1);
+}
+
+int psandbox_key_timedlock(size_t key, const struct timespec *abstime) {
+  return lock_key(key, abstime, 0);
+}
+
+int psandbox_key_unlock(size_t key) {
+  KeyStripe *stripe = stripe_of(key);
+  PSandboxWaiter *waiter;
+  PSandbox *psandbox;
+  KeyEntry **pos, *entry;
+  int contended;
+
+  pthread_mutex_lock(&stripe->lock);
+  pos = find_entry(stripe, key);
+  entry = *pos;
+  if (!entry) {
+    pthread_mutex_unlock(&stripe->lock);
+    return EPERM;
+  }
+  contended = entry->contended;
+  waiter = waitq_pop(&entry->waiters);
+  if (waiter) {
+    entry->contended = 1;
+    waiter_wake(waiter);
+  } else {
+    *pos = entry->next;
+    entry->next = stripe->spare;
+    stripe->spare = entry;
+  }
+  pthread_mutex_unlock(&stripe->lock);
+
+  if (waiter || contended) {
+    update_psandbox(key, UNHOLD);
+  } else {
+    psandbox = psandbox_self();
+    if (psandbox)
+      remove_holder(psandbox, key);
+  }
+  return 0;
+}
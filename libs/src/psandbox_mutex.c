@@ -0,0 +1,98 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_mutex.h"
+
+#include <errno.h>
+#include "psandbox_internal.h"
+
+static inline void hold_uncontended(psandbox_mutex_t *mutex) {
+  PSandbox *psandbox = psandbox_self();
+
+  if (psandbox)
+    add_holder(psandbox, (size_t) mutex, false);
+  mutex->contended = 0;
+}
+
+static int lock_contended(psandbox_mutex_t *mutex,
+                          const struct timespec *abstime) {
+  size_t key = (size_t) mutex;
+  int ret;
+
+  __atomic_add_fetch(&mutex->waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox(key, PREPARE);
+  if (abstime)
+    ret = pthread_mutex_timedlock(&mutex->mutex, abstime);
+  else
+    ret = pthread_mutex_lock(&mutex->mutex);
+  __atomic_sub_fetch(&mutex->waiters, 1, __ATOMIC_SEQ_CST);
+
+  // The kernel has no event for an abandoned wait; ENTER still closes the
+  // PREPARE so the waiting time is not charged forever.
+  update_psandbox(key, ENTER);
+  if (ret)
+    return ret;
+
+  mutex->contended = 1;
+  update_psandbox(key, HOLD);
+  return 0;
+}
+
+int psandbox_mutex_init(psandbox_mutex_t *mutex,
+                        const pthread_mutexattr_t *attr) {
+  mutex->waiters = 0;
+  mutex->contended = 0;
+  return pthread_mutex_init(&mutex->mutex, attr);
+}
+
+int psandbox_mutex_destroy(psandbox_mutex_t *mutex) {
+  return pthread_mutex_destroy(&mutex->mutex);
+}
+
+int psandbox_mutex_lock(psandbox_mutex_t *mutex) {
+  if (pthread_mutex_trylock(&mutex->mutex) == 0) {
+    hold_uncontended(mutex);
+    return 0;
+  }
+  return lock_contended(mutex, NULL);
+}
+
+int psandbox_mutex_trylock(psandbox_mutex_t *mutex) {
+  int ret = pthread_mutex_trylock(&mutex->mutex);
+
+  if (ret == 0)
+    hold_uncontended(mutex);
+  return ret;
+}
+
+int psandbox_mutex_timedlock(psandbox_mutex_t *mutex,
+                             const struct timespec *abstime) {
+  if (pthread_mutex_trylock(&mutex->mutex) == 0) {
+    hold_uncontended(mutex);
+    return 0;
+  }
+  return lock_contended(mutex, abstime);
+}
+
+int psandbox_mutex_unlock(psandbox_mutex_t *mutex) {
+  PSandbox *psandbox;
+  int ret;
+
+  // A thread that starts waiting after this check finds the mutex free right
+  // after, so skipping UNHOLD for it loses nothing.
+  if (mutex->contended || __atomic_load_n(&mutex->waiters, __ATOMIC_SEQ_CST)) {
+    mutex->contended = 0;
+    ret = pthread_mutex_unlock(&mutex->mutex);
+    update_psandbox((size_t) mutex, UNHOLD);
+    return ret;
+  }
+
+  psandbox = psandbox_self();
+  if (psandbox)
+    remove_holder(psandbox, (size_t) mutex);
+  return pthread_mutex_unlock(&mutex->mutex);
+}
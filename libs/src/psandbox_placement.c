@@ -0,0 +1,184 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "../include/psandbox_placement.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "psandbox_internal.h"
+#include "psandbox_waitq.h"
+
+#define MAX_NODES 64
+
+enum {
+  PLACED_NONE = 0,   // the thread's own affinity
+  PLACED_RESERVED,
+  PLACED_SHARED,
+};
+
+int placement_enabled = 0;
+static int placement_active = 0;
+static int generation = 0;  // bumped whenever the sets below change
+static int min_priority = 0;
+static pthread_mutex_t placement_lock = PTHREAD_MUTEX_INITIALIZER;
+static cpu_set_t allowed;   // the CPUs before placement was enabled
+static cpu_set_t reserved;
+static cpu_set_t shared;    // allowed minus reserved
+
+static __thread int placed = PLACED_NONE;
+static __thread int placed_generation;
+static __thread long placed_at;  // ns, the last move onto the reserved CPUs
+
+/// @brief Parse a cpulist such as "0-3,8,10-11" into set
+static void parse_cpulist(const char *list, cpu_set_t *set) {
+  char *end;
+  long first, last;
+
+  CPU_ZERO(set);
+  while (*list) {
+    first = strtol(list, &end, 10);
+    if (end == list)
+      break;
+    last = first;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    for (; first <= last && first < CPU_SETSIZE; first++)
+      CPU_SET(first, set);
+    list = *end == ',' ? end + 1 : end;
+  }
+}
+
+/// @return 0 if the node exists and set has its CPUs, -1 otherwise
+static int read_node(int node, cpu_set_t *set) {
+  char path[64], list[1024];
+  FILE *file;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  file = fopen(path, "r");
+  if (!file)
+    return -1;
+  if (!fgets(list, sizeof(list), file))
+    list[0] = '\0';
+  fclose(file);
+  parse_cpulist(list, set);
+  return 0;
+}
+
+/// Pick the node with the most allowed CPUs; without NUMA information
+/// every allowed CPU counts as one node.
+static void largest_node(cpu_set_t *node) {
+  cpu_set_t cpus;
+  int i, best = 0;
+
+  *node = allowed;
+  for (i = 0; i < MAX_NODES; i++) {
+    if (read_node(i, &cpus))
+      continue;
+    CPU_AND(&cpus, &cpus, &allowed);
+    if (CPU_COUNT(&cpus) > best) {
+      best = CPU_COUNT(&cpus);
+      *node = cpus;
+    }
+  }
+}
+
+int psandbox_placement_enable(int reserved_cpus, int priority) {
+  cpu_set_t node, cpus;
+  int cpu;
+
+  pthread_mutex_lock(&placement_lock);
+  if (!placement_active && sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    pthread_mutex_unlock(&placement_lock);
+    return -1;
+  }
+  largest_node(&node);
+  if (reserved_cpus <= 0 || CPU_COUNT(&node) < reserved_cpus ||
+      CPU_COUNT(&allowed) <= reserved_cpus) {
+    printf("Error: Can't reserve %d of %d cpus\n", reserved_cpus,
+           CPU_COUNT(&allowed));
+    pthread_mutex_unlock(&placement_lock);
+    return -1;
+  }
+
+  // The highest numbered ones, away from where interrupts usually go.
+  CPU_ZERO(&cpus);
+  for (cpu = CPU_SETSIZE - 1; cpu >= 0 && CPU_COUNT(&cpus) < reserved_cpus;
+       cpu--) {
+    if (CPU_ISSET(cpu, &node))
+      CPU_SET(cpu, &cpus);
+  }
+  reserved = cpus;
+  CPU_XOR(&shared, &allowed, &reserved);
+  min_priority = priority;
+  __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+  placement_active = 1;
+  __atomic_store_n(&placement_enabled, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&placement_lock);
+  return 0;
+}
+
+void psandbox_placement_disable() {
+  // placement_enabled stays set, so that placed threads are put back.
+  pthread_mutex_lock(&placement_lock);
+  placement_active = 0;
+  __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&placement_lock);
+}
+
+void psandbox_placement_reserved(cpu_set_t *set) {
+  pthread_mutex_lock(&placement_lock);
+  if (placement_active)
+    *set = reserved;
+  else
+    CPU_ZERO(set);
+  pthread_mutex_unlock(&placement_lock);
+}
+
+static int wanted_place(PSandbox *psandbox) {
+  if (!placement_active)
+    return PLACED_NONE;
+  if (!psandbox)
+    return placed;
+  if (psandbox->rule.priority >= min_priority &&
+      !__atomic_load_n(&psandbox->penalty_debt, __ATOMIC_RELAXED))
+    return PLACED_RESERVED;
+  return PLACED_SHARED;
+}
+
+void placement_apply(PSandbox *psandbox) {
+  int want, current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+  long now = 0;
+
+  want = wanted_place(psandbox);
+  if (want == placed && current == placed_generation)
+    return;
+  if (want == PLACED_RESERVED) {
+    now = waitq_now();
+    if (placed_at && now - placed_at < PSANDBOX_PLACEMENT_HOLD_NS &&
+        current == placed_generation)
+      return;
+  }
+
+  pthread_mutex_lock(&placement_lock);
+  want = wanted_place(psandbox);
+  if (want == PLACED_RESERVED)
+    sched_setaffinity(0, sizeof(reserved), &reserved);
+  else if (want == PLACED_SHARED)
+    sched_setaffinity(0, sizeof(shared), &shared);
+  else if (placed != PLACED_NONE)
+    sched_setaffinity(0, sizeof(allowed), &allowed);
+  placed_generation = generation;
+  pthread_mutex_unlock(&placement_lock);
+  placed = want;
+  if (want == PLACED_RESERVED)
+    placed_at = now;
+}
@@ -0,0 +1,197 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "psandbox_internal.h"
+
+typedef struct poolClass {
+  IsolationRule rule;
+  int used;
+  int count;
+  int ids[PSANDBOX_POOL_SIZE];
+} PoolClass;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static PoolClass pool_classes[PSANDBOX_POOL_CLASSES];
+static pthread_once_t pool_atfork_once = PTHREAD_ONCE_INIT;
+
+static void pool_atfork_prepare() {
+  pthread_mutex_lock(&pool_lock);
+}
+
+static void pool_atfork_parent() {
+  pthread_mutex_unlock(&pool_lock);
+}
+
+/// The pooled sandboxes are the parent's; the child starts with an empty pool.
+static void pool_atfork_child() {
+  pthread_mutex_init(&pool_lock, NULL);
+  memset(pool_classes, 0, sizeof(pool_classes));
+}
+
+static void register_pool_atfork() {
+  pthread_atfork(pool_atfork_prepare, pool_atfork_parent, pool_atfork_child);
+}
+
+static int same_rule(IsolationRule a, IsolationRule b) {
+  return a.type == b.type && a.isolation_level == b.isolation_level &&
+      a.priority == b.priority && a.is_retro == b.is_retro;
+}
+
+/// @return The class of rule, a new one if create is set, NULL if none
+static PoolClass *find_class(IsolationRule rule, int create) {
+  PoolClass *free_class = NULL;
+  int i;
+
+  for (i = 0; i < PSANDBOX_POOL_CLASSES; i++) {
+    if (!pool_classes[i].used) {
+      if (!free_class)
+        free_class = &pool_classes[i];
+      continue;
+    }
+    if (same_rule(pool_classes[i].rule, rule))
+      return &pool_classes[i];
+  }
+  if (!create || !free_class)
+    return NULL;
+  free_class->used = 1;
+  free_class->rule = rule;
+  free_class->count = 0;
+  return free_class;
+}
+
+/// A sandbox that still holds keys has kernel state an UNHOLD never cleared.
+/// One whose SLO class moved to another level is replaced, as the kernel
+/// only takes a level at creation.
+static int is_reusable(PSandbox *psandbox) {
+  return !psandbox->holder_count &&
+      (!psandbox->slo_class ||
+       psandbox->slo_level == psandbox->rule.isolation_level);
+}
+
+/// Forget everything the last user did with the sandbox. Only the id, the
+/// rule, the SLO class and the cold part are kept.
+static void reset_psandbox(PSandbox *psandbox) {
+  psandbox->wait_time = 0;
+  psandbox->holders_shared = 0;
+  psandbox->hold_resource = 0;
+  psandbox->is_sample = 0;
+  if (psandbox->cold) {
+    if (psandbox->cold->count)
+      memset(psandbox->cold->result, 0, sizeof(psandbox->cold->result));
+    psandbox->cold->count = 0;
+    psandbox->cold->activity = 0;
+  }
+  psandbox->sample_count = 0;
+  psandbox->penalty_debt = 0;
+  psandbox->penalty_stamp = 0;
+  memset(psandbox->penalty_keys, 0, sizeof(psandbox->penalty_keys));
+  memset(psandbox->penalty_amounts, 0, sizeof(psandbox->penalty_amounts));
+  psandbox->tid = 0;
+  psandbox->waiting_on = 0;
+  psandbox->wait_start = 0;
+  psandbox->inherited_priority = 0;
+  psandbox->base_nice = 0;
+  psandbox->boost_nice = 0;
+  psandbox->boosted = 0;
+  psandbox->slo_start = 0;
+  psandbox->slo_wait_start = 0;
+  psandbox->deadline = 0;
+  psandbox->deadline_activities = 0;
+  psandbox->deadline_misses = 0;
+  psandbox->admission_class = 0;
+  psandbox->admission_wait = 0;
+}
+
+int psandbox_pool_get(IsolationRule rule) {
+  PoolClass *pool_class;
+  PSandbox *psandbox;
+  int id = 0, admitted = 0;
+
+  pthread_once(&pool_atfork_once, register_pool_atfork);
+  rule = normalize_rule(rule);
+  // A pooled sandbox is not in flight; taking one is admitted like a create.
+  if (admission_enabled) {
+    admitted = admission_admit(rule);
+    if (admitted < 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+  pthread_mutex_lock(&pool_lock);
+  pool_class = find_class(rule, 0);
+  if (pool_class && pool_class->count)
+    id = pool_class->ids[--pool_class->count];
+  pthread_mutex_unlock(&pool_lock);
+
+  // A pooled sandbox that can't be bound is not known to be parked any more,
+  // so it is only left out of the pool, not released.
+  if (id && bind_psandbox(psandbox_park_key(id)) != id) {
+    printf("Error: Can't bind the pooled sandbox %d\n", id);
+    id = 0;
+  }
+  if (!id) {
+    admission_done(admitted);
+    return create_psandbox(rule);
+  }
+  psandbox = psandbox_self();
+  if (psandbox)
+    psandbox->admission_class = admitted;
+  return id;
+}
+
+int psandbox_pool_put(int pid) {
+  PSandbox *psandbox = psandbox_self();
+  PoolClass *pool_class;
+
+  if (pid == -1)
+    return 0;
+  if (!psandbox || psandbox->pid != pid || !is_reusable(psandbox))
+    return release_psandbox(pid);
+
+  pthread_once(&pool_atfork_once, register_pool_atfork);
+  admission_done(psandbox->admission_class);
+  reset_psandbox(psandbox);
+  if (unbind_psandbox(psandbox_park_key(pid), pid, UNBIND_NONE) < 0)
+    return release_psandbox(pid);
+
+  pthread_mutex_lock(&pool_lock);
+  pool_class = find_class(psandbox->rule, 1);
+  if (pool_class && pool_class->count < PSANDBOX_POOL_SIZE) {
+    pool_class->ids[pool_class->count++] = pid;
+    pid = 0;
+  }
+  pthread_mutex_unlock(&pool_lock);
+
+  if (pid) {
+    bind_psandbox(psandbox_park_key(pid));
+    return release_psandbox(pid);
+  }
+  return 1;
+}
+
+void psandbox_pool_drain() {
+  int i, id;
+
+  for (i = 0; i < PSANDBOX_POOL_CLASSES; i++) {
+    for (;;) {
+      pthread_mutex_lock(&pool_lock);
+      id = pool_classes[i].count ? pool_classes[i].ids[--pool_classes[i].count]
+                                 : 0;
+      pthread_mutex_unlock(&pool_lock);
+      if (!id)
+        break;
+      bind_psandbox(psandbox_park_key(id));
+      release_psandbox(id);
+    }
+  }
+}
@@ -0,0 +1,390 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// libpsandbox_preload.so: instruments an unmodified program by interposing the
+// pthread mutex/rwlock/cond and POSIX semaphore entry points.
+//
+//   LD_PRELOAD=libpsandbox_preload.so ./server
+//
+// The address of the synchronization object is the event key. Every acquire
+// is first attempted with the non-blocking variant; only when that fails are
+// PREPARE/ENTER/HOLD reported around the blocking call, and UNHOLD is only
+// reported on release when the object is known to be contended. Semaphores
+// only report PREPARE/ENTER around a blocking wait. Contention is
+// remembered in a small direct-mapped cache indexed by address, so the
+// uncontended path costs a trylock plus a cache probe.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/psandbox.h"
+
+#define CONTENTION_CACHE_SIZE 4096
+
+typedef struct contentionEntry {
+  size_t key;
+  int waiters;    // threads blocked on the object
+  int contended;  // the current owner waited for the object
+} ContentionEntry;
+
+static ContentionEntry contention_cache[CONTENTION_CACHE_SIZE];
+
+// Set while a wrapper runs, so that locks taken by libpsandbox itself (or by
+// dlsym) fall straight through to libc.
+static __thread int in_hook __attribute__((tls_model("initial-exec")));
+
+static int (*real_mutex_lock)(pthread_mutex_t *);
+static int (*real_mutex_trylock)(pthread_mutex_t *);
+static int (*real_mutex_timedlock)(pthread_mutex_t *, const struct timespec *);
+static int (*real_mutex_unlock)(pthread_mutex_t *);
+static int (*real_rwlock_rdlock)(pthread_rwlock_t *);
+static int (*real_rwlock_tryrdlock)(pthread_rwlock_t *);
+static int (*real_rwlock_timedrdlock)(pthread_rwlock_t *,
+                                      const struct timespec *);
+static int (*real_rwlock_wrlock)(pthread_rwlock_t *);
+static int (*real_rwlock_trywrlock)(pthread_rwlock_t *);
+static int (*real_rwlock_timedwrlock)(pthread_rwlock_t *,
+                                      const struct timespec *);
+static int (*real_rwlock_unlock)(pthread_rwlock_t *);
+static int (*real_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *,
+                                  const struct timespec *);
+static int (*real_cond_signal)(pthread_cond_t *);
+static int (*real_cond_broadcast)(pthread_cond_t *);
+static int (*real_sem_wait)(sem_t *);
+static int (*real_sem_trywait)(sem_t *);
+static int (*real_sem_timedwait)(sem_t *, const struct timespec *);
+static int (*real_sem_post)(sem_t *);
+
+static void *resolve(const char *name, const char *version) {
+  void *sym = NULL;
+
+#if defined(__x86_64__)
+  // dlsym() picks the oldest version of the condvar functions, which is the
+  // pre-2.3.2 compat implementation. Ask for the current one explicitly.
+  if (version)
+    sym = dlvsym(RTLD_NEXT, name, version);
+#else
+  (void) version;
+#endif
+  if (!sym)
+    sym = dlsym(RTLD_NEXT, name);
+  if (!sym) {
+    fprintf(stderr, "psandbox_preload: can't resolve %s\n", name);
+    abort();
+  }
+  return sym;
+}
+
+#define RESOLVE(fn, name, version)                        \
+  do {                                                    \
+    if (__builtin_expect(fn == NULL, 0))                  \
+      *(void **) (&fn) = resolve(name, version);          \
+  } while (0)
+
+__attribute__((constructor)) static void preload_init() {
+  in_hook = 1;
+  RESOLVE(real_mutex_lock, "pthread_mutex_lock", NULL);
+  RESOLVE(real_mutex_trylock, "pthread_mutex_trylock", NULL);
+  RESOLVE(real_mutex_timedlock, "pthread_mutex_timedlock", NULL);
+  RESOLVE(real_mutex_unlock, "pthread_mutex_unlock", NULL);
+  RESOLVE(real_rwlock_rdlock, "pthread_rwlock_rdlock", NULL);
+  RESOLVE(real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock", NULL);
+  RESOLVE(real_rwlock_timedrdlock, "pthread_rwlock_timedrdlock", NULL);
+  RESOLVE(real_rwlock_wrlock, "pthread_rwlock_wrlock", NULL);
+  RESOLVE(real_rwlock_trywrlock, "pthread_rwlock_trywrlock", NULL);
+  RESOLVE(real_rwlock_timedwrlock, "pthread_rwlock_timedwrlock", NULL);
+  RESOLVE(real_rwlock_unlock, "pthread_rwlock_unlock", NULL);
+  RESOLVE(real_cond_wait, "pthread_cond_wait", "GLIBC_2.3.2");
+  RESOLVE(real_cond_timedwait, "pthread_cond_timedwait", "GLIBC_2.3.2");
+  RESOLVE(real_cond_signal, "pthread_cond_signal", "GLIBC_2.3.2");
+  RESOLVE(real_cond_broadcast, "pthread_cond_broadcast", "GLIBC_2.3.2");
+  RESOLVE(real_sem_wait, "sem_wait", NULL);
+  RESOLVE(real_sem_trywait, "sem_trywait", NULL);
+  RESOLVE(real_sem_timedwait, "sem_timedwait", NULL);
+  RESOLVE(real_sem_post, "sem_post", NULL);
+  in_hook = 0;
+}
+
+static inline ContentionEntry *cache_entry(const void *object) {
+  size_t key = (size_t) object;
+  return &contention_cache[(key >> 4) % CONTENTION_CACHE_SIZE];
+}
+
+/// Called before blocking on an object that the non-blocking attempt failed
+/// to acquire. The entry is claimed for the object; a colliding object only
+/// costs an extra UNHOLD of the other object later on, see report_release.
+static ContentionEntry *begin_wait(const void *object) {
+  ContentionEntry *entry = cache_entry(object);
+
+  if (__atomic_load_n(&entry->key, __ATOMIC_RELAXED) != (size_t) object)
+    __atomic_store_n(&entry->key, (size_t) object, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&entry->waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox((size_t) object, PREPARE);
+  return entry;
+}
+
+static void end_wait(ContentionEntry *entry, const void *object, int ret,
+                     enum enum_event_type hold) {
+  __atomic_sub_fetch(&entry->waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox((size_t) object, ENTER);
+  if (ret == 0) {
+    entry->contended = 1;
+    update_psandbox((size_t) object, hold);
+  }
+}
+
+enum release_kind { RELEASE_QUIET, RELEASE_HELD, RELEASE_WAITED };
+
+/// @return Whether the release of object must be reported to the kernel:
+/// RELEASE_HELD if the owner waited for it and so reported HOLD,
+/// RELEASE_WAITED if it took it uncontended but others wait for it now.
+static inline int release_contended(const void *object) {
+  ContentionEntry *entry = cache_entry(object);
+
+  if (__atomic_load_n(&entry->key, __ATOMIC_RELAXED) != (size_t) object)
+    return RELEASE_QUIET;
+  if (entry->contended) {
+    entry->contended = 0;
+    return RELEASE_HELD;
+  }
+  return __atomic_load_n(&entry->waiters, __ATOMIC_SEQ_CST) != 0
+             ? RELEASE_WAITED : RELEASE_QUIET;
+}
+
+/// An owner that took the object uncontended never reported HOLD, so the
+/// library has no holder entry to drop and would swallow a plain UNHOLD; it
+/// is passed to the kernel as is, for the waiters to be woken there.
+static inline void report_release(const void *object, int kind) {
+  if (kind == RELEASE_HELD)
+    update_psandbox((size_t) object, UNHOLD);
+  else if (kind == RELEASE_WAITED)
+    do_update_psandbox((size_t) object, UNHOLD, false, true);
+}
+
+#define ACQUIRE(object, trylock_call, lock_call, hold) \
+  do {                                              \
+    ContentionEntry *entry;                         \
+    int ret;                                        \
+    if (in_hook)                                    \
+      return lock_call;                             \
+    if ((ret = trylock_call) == 0)                  \
+      return 0;                                     \
+    if (ret != EBUSY)                               \
+      return ret;                                   \
+    in_hook = 1;                                    \
+    entry = begin_wait(object);                     \
+    ret = lock_call;                                \
+    end_wait(entry, object, ret, hold);             \
+    in_hook = 0;                                    \
+    return ret;                                     \
+  } while (0)
+
+/// Semaphores have no owner and may be posted by any thread, so there is
+/// nothing to hold: a wait is only reported as one, and a post not at all.
+#define WAIT(object, try_call, wait_call)           \
+  do {                                              \
+    int ret;                                        \
+    if (in_hook)                                    \
+      return wait_call;                             \
+    if (try_call == 0)                              \
+      return 0;                                     \
+    in_hook = 1;                                    \
+    update_psandbox((size_t) object, PREPARE);      \
+    ret = wait_call;                                \
+    update_psandbox((size_t) object, ENTER);        \
+    in_hook = 0;                                    \
+    return ret;                                     \
+  } while (0)
+
+#define RELEASE(object, unlock_call)                \
+  do {                                              \
+    int ret, kind;                                  \
+    if (in_hook ||                                  \
+        !(kind = release_contended(object)))        \
+      return unlock_call;                           \
+    in_hook = 1;                                    \
+    ret = unlock_call;                              \
+    report_release(object, kind);                   \
+    in_hook = 0;                                    \
+    return ret;                                     \
+  } while (0)
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  RESOLVE(real_mutex_lock, "pthread_mutex_lock", NULL);
+  RESOLVE(real_mutex_trylock, "pthread_mutex_trylock", NULL);
+  ACQUIRE(mutex, real_mutex_trylock(mutex), real_mutex_lock(mutex), HOLD);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  RESOLVE(real_mutex_trylock, "pthread_mutex_trylock", NULL);
+  return real_mutex_trylock(mutex);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *mutex,
+                            const struct timespec *abstime) {
+  RESOLVE(real_mutex_timedlock, "pthread_mutex_timedlock", NULL);
+  RESOLVE(real_mutex_trylock, "pthread_mutex_trylock", NULL);
+  ACQUIRE(mutex, real_mutex_trylock(mutex),
+          real_mutex_timedlock(mutex, abstime), HOLD);
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  RESOLVE(real_mutex_unlock, "pthread_mutex_unlock", NULL);
+  RELEASE(mutex, real_mutex_unlock(mutex));
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) {
+  RESOLVE(real_rwlock_rdlock, "pthread_rwlock_rdlock", NULL);
+  RESOLVE(real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock", NULL);
+  ACQUIRE(rwlock, real_rwlock_tryrdlock(rwlock), real_rwlock_rdlock(rwlock),
+          HOLD_SHARED);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) {
+  RESOLVE(real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock", NULL);
+  return real_rwlock_tryrdlock(rwlock);
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock,
+                               const struct timespec *abstime) {
+  RESOLVE(real_rwlock_timedrdlock, "pthread_rwlock_timedrdlock", NULL);
+  RESOLVE(real_rwlock_tryrdlock, "pthread_rwlock_tryrdlock", NULL);
+  ACQUIRE(rwlock, real_rwlock_tryrdlock(rwlock),
+          real_rwlock_timedrdlock(rwlock, abstime), HOLD_SHARED);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) {
+  RESOLVE(real_rwlock_wrlock, "pthread_rwlock_wrlock", NULL);
+  RESOLVE(real_rwlock_trywrlock, "pthread_rwlock_trywrlock", NULL);
+  ACQUIRE(rwlock, real_rwlock_trywrlock(rwlock), real_rwlock_wrlock(rwlock),
+          HOLD);
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
+  RESOLVE(real_rwlock_trywrlock, "pthread_rwlock_trywrlock", NULL);
+  return real_rwlock_trywrlock(rwlock);
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock,
+                               const struct timespec *abstime) {
+  RESOLVE(real_rwlock_timedwrlock, "pthread_rwlock_timedwrlock", NULL);
+  RESOLVE(real_rwlock_trywrlock, "pthread_rwlock_trywrlock", NULL);
+  ACQUIRE(rwlock, real_rwlock_trywrlock(rwlock),
+          real_rwlock_timedwrlock(rwlock, abstime), HOLD);
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) {
+  RESOLVE(real_rwlock_unlock, "pthread_rwlock_unlock", NULL);
+  RELEASE(rwlock, real_rwlock_unlock(rwlock));
+}
+
+static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                     const struct timespec *abstime) {
+  ContentionEntry *entry;
+  int ret;
+
+  // The mutex is dropped inside the wait, so a contended mutex is released
+  // here as far as the kernel is concerned and re-acquired on wake up.
+  report_release(mutex, release_contended(mutex));
+  entry = begin_wait(cond);
+  if (abstime)
+    ret = real_cond_timedwait(cond, mutex, abstime);
+  else
+    ret = real_cond_wait(cond, mutex);
+  __atomic_sub_fetch(&entry->waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox((size_t) cond, ENTER);
+  return ret;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  int ret;
+
+  RESOLVE(real_cond_wait, "pthread_cond_wait", "GLIBC_2.3.2");
+  if (in_hook)
+    return real_cond_wait(cond, mutex);
+  in_hook = 1;
+  ret = cond_wait(cond, mutex, NULL);
+  in_hook = 0;
+  return ret;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+  int ret;
+
+  RESOLVE(real_cond_timedwait, "pthread_cond_timedwait", "GLIBC_2.3.2");
+  if (in_hook)
+    return real_cond_timedwait(cond, mutex, abstime);
+  in_hook = 1;
+  ret = cond_wait(cond, mutex, abstime);
+  in_hook = 0;
+  return ret;
+}
+
+static inline int cond_has_waiters(const pthread_cond_t *cond) {
+  ContentionEntry *entry = cache_entry(cond);
+
+  return __atomic_load_n(&entry->key, __ATOMIC_RELAXED) == (size_t) cond &&
+         __atomic_load_n(&entry->waiters, __ATOMIC_SEQ_CST) != 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+  int ret;
+
+  RESOLVE(real_cond_signal, "pthread_cond_signal", "GLIBC_2.3.2");
+  if (in_hook || !cond_has_waiters(cond))
+    return real_cond_signal(cond);
+  in_hook = 1;
+  ret = real_cond_signal(cond);
+  update_psandbox((size_t) cond, COND_WAKE);
+  in_hook = 0;
+  return ret;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+  int ret;
+
+  RESOLVE(real_cond_broadcast, "pthread_cond_broadcast", "GLIBC_2.3.2");
+  if (in_hook || !cond_has_waiters(cond))
+    return real_cond_broadcast(cond);
+  in_hook = 1;
+  ret = real_cond_broadcast(cond);
+  update_psandbox((size_t) cond, COND_WAKE);
+  in_hook = 0;
+  return ret;
+}
+
+// sem_* report failures through errno; any failed attempt falls back to the
+// blocking call, which sets errno properly.
+int sem_wait(sem_t *sem) {
+  RESOLVE(real_sem_wait, "sem_wait", NULL);
+  RESOLVE(real_sem_trywait, "sem_trywait", NULL);
+  WAIT(sem, real_sem_trywait(sem), real_sem_wait(sem));
+}
+
+int sem_trywait(sem_t *sem) {
+  RESOLVE(real_sem_trywait, "sem_trywait", NULL);
+  return real_sem_trywait(sem);
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime) {
+  RESOLVE(real_sem_timedwait, "sem_timedwait", NULL);
+  RESOLVE(real_sem_trywait, "sem_trywait", NULL);
+  WAIT(sem, real_sem_trywait(sem), real_sem_timedwait(sem, abstime));
+}
+
+int sem_post(sem_t *sem) {
+  RESOLVE(real_sem_post, "sem_post", NULL);
+  return real_sem_post(sem);
+}
@@ -0,0 +1,103 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_queue.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "psandbox_internal.h"
+
+// Dmitry Vyukov's bounded MPMC queue. Cell i of lap n carries seq n * size + i
+// while it is free for the producer of position n * size + i, and one more
+// once that producer filled it. Claiming a position is a single CAS on the
+// producer or consumer index.
+
+int psandbox_queue_init(psandbox_queue_t *queue, size_t capacity) {
+  size_t i;
+
+  if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+    return EINVAL;
+  queue->cells = (PSandboxQueueCell *) malloc(sizeof(PSandboxQueueCell) *
+                                              capacity);
+  if (!queue->cells)
+    return ENOMEM;
+  for (i = 0; i < capacity; i++) {
+    queue->cells[i].seq = i;
+    queue->cells[i].data = NULL;
+    queue->cells[i].psandbox = 0;
+  }
+  queue->mask = capacity - 1;
+  queue->enqueue_pos = 0;
+  queue->dequeue_pos = 0;
+  return 0;
+}
+
+void psandbox_queue_destroy(psandbox_queue_t *queue) {
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+int psandbox_queue_push(psandbox_queue_t *queue, void *data) {
+  PSandboxQueueCell *cell;
+  size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+  int psandbox;
+
+  for (;;) {
+    cell = &queue->cells[pos & queue->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return EAGAIN;
+    } else {
+      pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  // The cell is ours until seq is published, so its address is a key no
+  // other in-flight task can be using.
+  psandbox = psandbox_self_id();
+  if (psandbox && unbind_psandbox((size_t) cell, psandbox, UNBIND_NONE) < 0)
+    psandbox = 0;
+  cell->data = data;
+  cell->psandbox = psandbox;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int psandbox_queue_pop(psandbox_queue_t *queue, void **data) {
+  PSandboxQueueCell *cell;
+  size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+  for (;;) {
+    cell = &queue->cells[pos & queue->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return EAGAIN;
+    } else {
+      pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  *data = cell->data;
+  // Bind before the cell is recycled, while the key still means this task.
+  if (cell->psandbox)
+    bind_psandbox((size_t) cell);
+  __atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+  return 0;
+}
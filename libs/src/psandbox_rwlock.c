@@ -0,0 +1,196 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "../include/psandbox_rwlock.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include "psandbox_internal.h"
+
+// Readers announce themselves in their cpu's slot and then check for a writer;
+// a writer raises the writer flag and then sums the slots. Both sides use
+// sequentially consistent accesses, so at least one of them sees the other.
+
+static inline PSandboxReaderSlot *reader_slot(psandbox_rwlock_t *rwlock) {
+  int cpu = sched_getcpu();
+
+  if (cpu < 0)
+    cpu = 0;
+  return &rwlock->slot[cpu & (PSANDBOX_RWLOCK_SLOTS - 1)];
+}
+
+static long count_readers(psandbox_rwlock_t *rwlock) {
+  long readers = 0;
+  int i;
+
+  for (i = 0; i < PSANDBOX_RWLOCK_SLOTS; i++) {
+    readers += __atomic_load_n(&rwlock->slot[i].readers, __ATOMIC_SEQ_CST);
+  }
+  return readers;
+}
+
+/// @return 1 if a writer was waiting for the readers to drain
+static int read_leave(psandbox_rwlock_t *rwlock) {
+  __atomic_sub_fetch(&reader_slot(rwlock)->readers, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&rwlock->writer, __ATOMIC_SEQ_CST)) {
+    __atomic_add_fetch(&rwlock->drain, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&rwlock->drain, 1);
+    return 1;
+  }
+  return 0;
+}
+
+static int read_enter(psandbox_rwlock_t *rwlock) {
+  __atomic_add_fetch(&reader_slot(rwlock)->readers, 1, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&rwlock->writer, __ATOMIC_SEQ_CST))
+    return 1;
+  read_leave(rwlock);
+  return 0;
+}
+
+static inline void hold_local(psandbox_rwlock_t *rwlock, int shared) {
+  PSandbox *psandbox = psandbox_self();
+
+  if (psandbox)
+    add_holder(psandbox, (size_t) rwlock, shared);
+}
+
+static inline void unhold_local(psandbox_rwlock_t *rwlock) {
+  PSandbox *psandbox = psandbox_self();
+
+  if (psandbox)
+    remove_holder(psandbox, (size_t) rwlock);
+}
+
+static void writer_leave(psandbox_rwlock_t *rwlock) {
+  __atomic_store_n(&rwlock->writer, 0, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&rwlock->read_waiters, __ATOMIC_SEQ_CST))
+    futex_wake(&rwlock->writer, INT_MAX);
+  pthread_mutex_unlock(&rwlock->writer_lock);
+}
+
+int psandbox_rwlock_init(psandbox_rwlock_t *rwlock) {
+  memset(rwlock->slot, 0, sizeof(rwlock->slot));
+  rwlock->writer = 0;
+  rwlock->drain = 0;
+  rwlock->read_waiters = 0;
+  rwlock->write_waiters = 0;
+  rwlock->contended = 0;
+  return pthread_mutex_init(&rwlock->writer_lock, NULL);
+}
+
+int psandbox_rwlock_destroy(psandbox_rwlock_t *rwlock) {
+  return pthread_mutex_destroy(&rwlock->writer_lock);
+}
+
+int psandbox_rwlock_rdlock(psandbox_rwlock_t *rwlock) {
+  size_t key = (size_t) rwlock;
+
+  if (read_enter(rwlock)) {
+    hold_local(rwlock, true);
+    return 0;
+  }
+
+  __atomic_add_fetch(&rwlock->read_waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox(key, PREPARE);
+  do {
+    futex_wait(&rwlock->writer, 1, NULL);
+  } while (!read_enter(rwlock));
+  __atomic_sub_fetch(&rwlock->read_waiters, 1, __ATOMIC_SEQ_CST);
+  update_psandbox(key, ENTER);
+  update_psandbox(key, HOLD_SHARED);
+  return 0;
+}
+
+int psandbox_rwlock_tryrdlock(psandbox_rwlock_t *rwlock) {
+  if (!read_enter(rwlock))
+    return EBUSY;
+  hold_local(rwlock, true);
+  return 0;
+}
+
+int psandbox_rwlock_rdunlock(psandbox_rwlock_t *rwlock) {
+  // Only a reader that a writer is waiting for is worth telling the kernel
+  // about; everyone else just leaves its slot.
+  if (read_leave(rwlock))
+    update_psandbox((size_t) rwlock, UNHOLD_SHARED);
+  else
+    unhold_local(rwlock);
+  return 0;
+}
+
+int psandbox_rwlock_wrlock(psandbox_rwlock_t *rwlock) {
+  size_t key = (size_t) rwlock;
+  int waited = 0;
+  int ret, drain;
+
+  if (pthread_mutex_trylock(&rwlock->writer_lock)) {
+    waited = 1;
+    __atomic_add_fetch(&rwlock->write_waiters, 1, __ATOMIC_SEQ_CST);
+    update_psandbox(key, PREPARE);
+    ret = pthread_mutex_lock(&rwlock->writer_lock);
+    __atomic_sub_fetch(&rwlock->write_waiters, 1, __ATOMIC_SEQ_CST);
+    if (ret) {
+      update_psandbox(key, ENTER);
+      return ret;
+    }
+  }
+
+  __atomic_store_n(&rwlock->writer, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    drain = __atomic_load_n(&rwlock->drain, __ATOMIC_SEQ_CST);
+    if (count_readers(rwlock) == 0)
+      break;
+    if (!waited) {
+      waited = 1;
+      update_psandbox(key, PREPARE);
+    }
+    futex_wait(&rwlock->drain, drain, NULL);
+  }
+
+  rwlock->contended = waited;
+  if (waited) {
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+  } else {
+    hold_local(rwlock, false);
+  }
+  return 0;
+}
+
+int psandbox_rwlock_trywrlock(psandbox_rwlock_t *rwlock) {
+  if (pthread_mutex_trylock(&rwlock->writer_lock))
+    return EBUSY;
+
+  __atomic_store_n(&rwlock->writer, 1, __ATOMIC_SEQ_CST);
+  if (count_readers(rwlock) != 0) {
+    writer_leave(rwlock);
+    return EBUSY;
+  }
+  rwlock->contended = 0;
+  hold_local(rwlock, false);
+  return 0;
+}
+
+int psandbox_rwlock_wrunlock(psandbox_rwlock_t *rwlock) {
+  int report = rwlock->contended ||
+               __atomic_load_n(&rwlock->read_waiters, __ATOMIC_SEQ_CST) ||
+               __atomic_load_n(&rwlock->write_waiters, __ATOMIC_SEQ_CST);
+
+  rwlock->contended = 0;
+  writer_leave(rwlock);
+  if (report)
+    update_psandbox((size_t) rwlock, UNHOLD);
+  else
+    unhold_local(rwlock);
+  return 0;
+}
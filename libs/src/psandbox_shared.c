@@ -0,0 +1,310 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_shared.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "psandbox_internal.h"
+
+#define REGISTRY_MAGIC 0x70736278
+// A sandbox lives within this many slots of pid % capacity, so a lookup stops
+// there even though removed slots leave holes in the probe sequence.
+#define REGISTRY_PROBES 64
+#define OPEN_RETRIES 1000
+// A state word is the state in its low bits and the pid of the process that
+// set it above, so that a slot left in any state by a dead process can be
+// told apart and taken back.
+#define STATE_BITS 3
+#define STATE_MASK ((1U << STATE_BITS) - 1)
+
+static PSandboxRegistry *registry;
+static size_t registry_size;
+
+static uint32_t state_word(int state) {
+  return (uint32_t) getpid() << STATE_BITS | state;
+}
+
+static uint32_t load_word(PSandboxSharedSlot *slot) {
+  return __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+}
+
+static int load_state(PSandboxSharedSlot *slot) {
+  return load_word(slot) & STATE_MASK;
+}
+
+static void store_state(PSandboxSharedSlot *slot, int state) {
+  __atomic_store_n(&slot->state, state_word(state), __ATOMIC_RELEASE);
+}
+
+static int cas_word(PSandboxSharedSlot *slot, uint32_t from, uint32_t to) {
+  return __atomic_compare_exchange_n(&slot->state, &from, to, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static int cas_state(PSandboxSharedSlot *slot, uint32_t from, uint32_t to) {
+  uint32_t word = load_word(slot);
+
+  if ((word & STATE_MASK) != from)
+    return 0;
+  return cas_word(slot, word, state_word(to));
+}
+
+static void free_slot(PSandboxSharedSlot *slot) {
+  slot->owner = 0;
+  slot->pid = 0;
+  __atomic_store_n(&slot->state, SHARED_FREE, __ATOMIC_RELEASE);
+}
+
+static int probes() {
+  return registry->capacity < REGISTRY_PROBES ? registry->capacity
+                                              : REGISTRY_PROBES;
+}
+
+/// @return The index of the slot of pid in state, -1 if there is none
+static int find_slot(int pid, int state) {
+  int i, n = probes();
+
+  for (i = 0; i < n; i++) {
+    int index = (int) (((unsigned int) pid + i) % registry->capacity);
+    PSandboxSharedSlot *slot = &registry->slots[index];
+
+    if (load_state(slot) == state && slot->pid == pid)
+      return index;
+  }
+  return -1;
+}
+
+static int holds_keys(PSandbox *psandbox) {
+  return psandbox->hold_resource || psandbox->holder_count;
+}
+
+int psandbox_registry_open(const char *name, unsigned int capacity) {
+  PSandboxRegistry *map;
+  struct stat st;
+  int fd, i, created = 1;
+  size_t size = sizeof(PSandboxRegistry) + capacity * sizeof(PSandboxSharedSlot);
+
+  if (registry)
+    return 0;
+  if (capacity == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1 && errno == EEXIST) {
+    created = 0;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if (fd == -1) {
+    printf("Error: Can't open the sandbox registry %s\n", name);
+    return -1;
+  }
+
+  if (created) {
+    if (ftruncate(fd, size)) {
+      close(fd);
+      shm_unlink(name);
+      return -1;
+    }
+  } else {
+    // The creator may not have sized it yet.
+    for (i = 0; i < OPEN_RETRIES; i++) {
+      if (fstat(fd, &st) == 0 && st.st_size > 0)
+        break;
+      sched_yield();
+    }
+    if (i == OPEN_RETRIES) {
+      close(fd);
+      errno = EAGAIN;
+      return -1;
+    }
+    size = st.st_size;
+  }
+
+  map = (PSandboxRegistry *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  if (created) {
+    map->capacity = capacity;
+    __atomic_store_n(&map->magic, REGISTRY_MAGIC, __ATOMIC_RELEASE);
+  } else {
+    for (i = 0; i < OPEN_RETRIES; i++) {
+      if (__atomic_load_n(&map->magic, __ATOMIC_ACQUIRE) == REGISTRY_MAGIC)
+        break;
+      sched_yield();
+    }
+    if (i == OPEN_RETRIES) {
+      munmap(map, size);
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+  registry_size = size;
+  registry = map;
+  return 0;
+}
+
+void psandbox_registry_close(const char *name, int unlink) {
+  if (registry) {
+    munmap(registry, registry_size);
+    registry = NULL;
+  }
+  if (unlink)
+    shm_unlink(name);
+}
+
+int psandbox_registry_add(int pid) {
+  PSandbox *psandbox;
+  int i, n;
+
+  if (!registry || pid <= 0)
+    return -1;
+  n = probes();
+  for (i = 0; i < n; i++) {
+    int index = (int) (((unsigned int) pid + i) % registry->capacity);
+    PSandboxSharedSlot *slot = &registry->slots[index];
+
+    if (!cas_state(slot, SHARED_FREE, SHARED_CLAIMED))
+      continue;
+    psandbox = psandbox_self();
+    slot->pid = pid;
+    slot->owner = getpid();
+    if (psandbox && psandbox->pid == pid)
+      slot->rule = psandbox->rule;
+    store_state(slot, SHARED_ACTIVE);
+    return 0;
+  }
+  return -1;
+}
+
+void psandbox_registry_remove(int pid) {
+  int index;
+
+  if (!registry)
+    return;
+  index = find_slot(pid, SHARED_ACTIVE);
+  if (index != -1 && registry->slots[index].owner == getpid())
+    free_slot(&registry->slots[index]);
+}
+
+int psandbox_registry_find(int pid, PSandboxSharedSlot *slot) {
+  int i, n, state;
+
+  if (!registry)
+    return -1;
+  n = probes();
+  for (i = 0; i < n; i++) {
+    int index = (int) (((unsigned int) pid + i) % registry->capacity);
+    PSandboxSharedSlot *candidate = &registry->slots[index];
+
+    state = load_state(candidate);
+    if (state == SHARED_FREE || state == SHARED_CLAIMED ||
+        candidate->pid != pid)
+      continue;
+    *slot = *candidate;
+    slot->state = state;  // without the pid of the process that set it
+    return 0;
+  }
+  return -1;
+}
+
+int psandbox_registry_reap() {
+  int i, count = 0;
+
+  if (!registry)
+    return 0;
+  // The process that last set the state is the owner of an active slot, the
+  // one claiming or binding a slot in between, and the one that handed a
+  // sandbox off, whose token is only good while it lives. The CAS on the
+  // whole word makes sure the slot did not change since.
+  for (i = 0; i < (int) registry->capacity; i++) {
+    PSandboxSharedSlot *slot = &registry->slots[i];
+    uint32_t word = load_word(slot);
+    pid_t setter = (pid_t) (word >> STATE_BITS);
+
+    if ((word & STATE_MASK) == SHARED_FREE || setter == 0)
+      continue;
+    if (kill(setter, 0) == 0 || errno != ESRCH)
+      continue;
+    if (cas_word(slot, word, state_word(SHARED_CLAIMED))) {
+      free_slot(slot);
+      count++;
+    }
+  }
+  return count;
+}
+
+uint64_t psandbox_handoff_unbind(int pid) {
+  PSandbox *psandbox = psandbox_self();
+  PSandboxSharedSlot *slot;
+  uint32_t generation;
+  int index;
+
+  if (!registry)
+    return 0;
+  if (psandbox && psandbox->pid == pid && holds_keys(psandbox)) {
+    printf("Error: Can't hand off sandbox %d while it holds keys\n", pid);
+    return 0;
+  }
+  index = find_slot(pid, SHARED_ACTIVE);
+  if (index == -1 || registry->slots[index].owner != getpid())
+    return 0;
+  slot = &registry->slots[index];
+
+  if (unbind_psandbox(psandbox_park_key(pid), pid, UNBIND_NONE) < 0)
+    return 0;
+  forget_psandbox(pid);
+
+  generation = __atomic_add_fetch(&slot->generation, 1, __ATOMIC_RELAXED);
+  if (generation == 0)
+    generation = __atomic_add_fetch(&slot->generation, 1, __ATOMIC_RELAXED);
+  slot->owner = 0;
+  store_state(slot, SHARED_HANDOFF);
+  return ((uint64_t) generation << 32) | (uint32_t) index;
+}
+
+int psandbox_handoff_bind(uint64_t token) {
+  PSandboxSharedSlot *slot;
+  uint32_t index = (uint32_t) token;
+  uint32_t generation = (uint32_t) (token >> 32);
+  uint32_t handoff;
+  int pid;
+
+  if (!registry || index >= registry->capacity)
+    return -1;
+  slot = &registry->slots[index];
+  handoff = load_word(slot);
+  if (__atomic_load_n(&slot->generation, __ATOMIC_RELAXED) != generation ||
+      (handoff & STATE_MASK) != SHARED_HANDOFF ||
+      !cas_word(slot, handoff, state_word(SHARED_BINDING)))
+    return -1;
+  // Only the owner bumps the generation, and there is none while in flight.
+  // Going back keeps the word of the process that handed the sandbox off.
+  if (slot->generation != generation) {
+    __atomic_store_n(&slot->state, handoff, __ATOMIC_RELEASE);
+    return -1;
+  }
+
+  pid = slot->pid;
+  if (bind_psandbox(psandbox_park_key(pid)) == -1) {
+    __atomic_store_n(&slot->state, handoff, __ATOMIC_RELEASE);
+    return -1;
+  }
+  adopt_psandbox(pid, slot->rule);
+  slot->owner = getpid();
+  store_state(slot, SHARED_ACTIVE);
+  return pid;
+}
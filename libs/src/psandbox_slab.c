@@ -0,0 +1,240 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "psandbox_slab.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SLAB_BYTES (2UL << 20) // one huge page
+#define SLAB_NODES 8           // depots; nodes beyond share them
+#define SLAB_CACHE 64          // free sandboxes a thread keeps at most
+#define SLAB_BATCH 32          // moved between a thread and its depot at once
+
+typedef struct slabObject {
+  struct slabObject *next;
+} SlabObject;
+
+typedef struct slabDepot {
+  pthread_mutex_t lock;
+  SlabObject *free;
+  char *carve;  // the next sandbox of the newest slab never handed out
+  char *end;
+} __attribute__((aligned(64))) SlabDepot;
+
+typedef struct slabCache {
+  SlabObject *free;
+  int count;
+  int node;  // the depot, -1 until the thread first allocates
+  long in_use;  // allocated minus freed by the thread, may go negative
+  struct slabCache *next;  // in caches
+} SlabCache;
+
+static SlabDepot depots[SLAB_NODES] = {
+    [0 ... SLAB_NODES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL}};
+static __thread SlabCache cache = {NULL, 0, -1, 0, NULL};
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static long slabs = 0;
+// The in_use counts are only summed when the stats are read, so allocating
+// and freeing touch no shared counter. Threads that exited leave theirs in
+// retired.
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static SlabCache *caches = NULL;
+static long retired = 0;
+
+#define OBJECT_SIZE \
+  ((sizeof(PSandbox) + __alignof__(PSandbox) - 1) & ~(__alignof__(PSandbox) - 1))
+
+/// Hand the cache's sandboxes back to its depot when the thread exits.
+static void drain_cache(void *arg) {
+  SlabCache *thread_cache = (SlabCache *) arg;
+  SlabDepot *depot = &depots[thread_cache->node];
+  SlabCache **pos;
+  SlabObject *last;
+
+  pthread_mutex_lock(&caches_lock);
+  for (pos = &caches; *pos; pos = &(*pos)->next) {
+    if (*pos == thread_cache) {
+      *pos = thread_cache->next;
+      break;
+    }
+  }
+  retired += thread_cache->in_use;
+  pthread_mutex_unlock(&caches_lock);
+  thread_cache->in_use = 0;
+  // A later destructor that frees a sandbox binds the cache again.
+  thread_cache->node = -1;
+
+  if (!thread_cache->free)
+    return;
+  for (last = thread_cache->free; last->next; last = last->next) {
+  }
+  pthread_mutex_lock(&depot->lock);
+  last->next = depot->free;
+  depot->free = thread_cache->free;
+  pthread_mutex_unlock(&depot->lock);
+  thread_cache->free = NULL;
+  thread_cache->count = 0;
+}
+
+static void create_cache_key() {
+  pthread_key_create(&cache_key, drain_cache);
+}
+
+static int current_node() {
+  unsigned int cpu, node;
+
+  if (getcpu(&cpu, &node))
+    return 0;
+  return (int) (node % SLAB_NODES);
+}
+
+/// Tie the calling thread's cache to the depot of its node.
+static void bind_cache(SlabCache *thread_cache) {
+  thread_cache->node = current_node();
+  pthread_once(&cache_once, create_cache_key);
+  pthread_setspecific(cache_key, thread_cache);
+  pthread_mutex_lock(&caches_lock);
+  thread_cache->next = caches;
+  caches = thread_cache;
+  pthread_mutex_unlock(&caches_lock);
+}
+
+/// Only the owning thread changes the count, so a plain store will do.
+static void count_in_use(SlabCache *thread_cache, long delta) {
+  __atomic_store_n(&thread_cache->in_use, thread_cache->in_use + delta,
+                   __ATOMIC_RELAXED);
+}
+
+/// Map a slab aligned to its size, so it can be a single huge page.
+/// Called with the depot lock held.
+static int map_slab(SlabDepot *depot) {
+  char *map, *slab;
+  uintptr_t misalign;
+
+  map = (char *) mmap(NULL, SLAB_BYTES * 2, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  misalign = (uintptr_t) map & (SLAB_BYTES - 1);
+  slab = misalign ? map + SLAB_BYTES - misalign : map;
+  if (slab > map)
+    munmap(map, slab - map);
+  munmap(slab + SLAB_BYTES, map + SLAB_BYTES * 2 - (slab + SLAB_BYTES));
+#ifdef MADV_HUGEPAGE
+  madvise(slab, SLAB_BYTES, MADV_HUGEPAGE);
+#endif
+  depot->carve = slab;
+  depot->end = slab + SLAB_BYTES - SLAB_BYTES % OBJECT_SIZE;
+  __atomic_add_fetch(&slabs, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/// Move up to SLAB_BATCH sandboxes from the depot into the cache. A slab's
+/// pages are first touched here, when a newly carved sandbox is linked into
+/// the cache, by the calling thread of the depot's node.
+static void refill(SlabCache *thread_cache) {
+  SlabDepot *depot;
+  SlabObject *object;
+  int i;
+
+  if (thread_cache->node < 0)
+    bind_cache(thread_cache);
+  depot = &depots[thread_cache->node];
+  pthread_mutex_lock(&depot->lock);
+  for (i = 0; i < SLAB_BATCH; i++) {
+    if (depot->free) {
+      object = depot->free;
+      depot->free = object->next;
+    } else {
+      if (depot->carve == depot->end && map_slab(depot))
+        break;
+      object = (SlabObject *) depot->carve;
+      depot->carve += OBJECT_SIZE;
+    }
+    object->next = thread_cache->free;
+    thread_cache->free = object;
+    thread_cache->count++;
+  }
+  pthread_mutex_unlock(&depot->lock);
+}
+
+PSandbox *slab_alloc() {
+  SlabCache *thread_cache = &cache;
+  SlabObject *object;
+
+  if (!thread_cache->free)
+    refill(thread_cache);
+  object = thread_cache->free;
+  if (!object)
+    return NULL;
+  thread_cache->free = object->next;
+  thread_cache->count--;
+  count_in_use(thread_cache, 1);
+  memset(object, 0, sizeof(PSandbox));
+  return (PSandbox *) object;
+}
+
+void slab_free(PSandbox *psandbox) {
+  SlabCache *thread_cache = &cache;
+  SlabObject *object = (SlabObject *) psandbox, *batch;
+  SlabDepot *depot;
+  int i;
+
+  if (!psandbox)
+    return;
+  if (thread_cache->node < 0)
+    bind_cache(thread_cache);
+  count_in_use(thread_cache, -1);
+  object->next = thread_cache->free;
+  thread_cache->free = object;
+  if (++thread_cache->count <= SLAB_CACHE)
+    return;
+
+  // Keep half, so a thread that only frees (the reaper) or alternates
+  // around the limit does not take the depot lock every time.
+  batch = thread_cache->free;
+  for (i = 1; i < SLAB_BATCH; i++)
+    object = object->next;
+  thread_cache->free = object->next;
+  thread_cache->count -= SLAB_BATCH;
+  depot = &depots[thread_cache->node];
+  pthread_mutex_lock(&depot->lock);
+  object->next = depot->free;
+  depot->free = batch;
+  pthread_mutex_unlock(&depot->lock);
+}
+
+void slab_stats(long *mapped, long *allocated) {
+  SlabCache *thread_cache;
+  long sum;
+
+  *mapped = __atomic_load_n(&slabs, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&caches_lock);
+  sum = retired;
+  for (thread_cache = caches; thread_cache; thread_cache = thread_cache->next)
+    sum += __atomic_load_n(&thread_cache->in_use, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&caches_lock);
+  *allocated = sum;
+}
+
+void slab_atfork_child() {
+  int i;
+
+  for (i = 0; i < SLAB_NODES; i++)
+    pthread_mutex_init(&depots[i].lock, NULL);
+  // The caches of the threads that did not come along stay on the list: their
+  // memory is still there, and so are the sandboxes they count.
+  pthread_mutex_init(&caches_lock, NULL);
+}
@@ -0,0 +1,41 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// The allocator of PSandbox objects. Each thread keeps a few free sandboxes
+// of its own in front of a depot per NUMA node; a depot carves its sandboxes
+// out of 2MB slabs, backed by a huge page where the kernel allows it and
+// first touched by a thread of its node. Slabs are kept for reuse rather
+// than given back to the system.
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_SLAB_H
+#define PSANDBOX_USERLIB_PSANDBOX_SLAB_H
+
+#include "../include/psandbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief A zeroed, cacheline aligned sandbox
+/// @return The sandbox, NULL if out of memory
+PSandbox *slab_alloc();
+
+/// @brief Give back a sandbox from slab_alloc; its cold part is not freed
+void slab_free(PSandbox *psandbox);
+
+/// @brief Slabs mapped so far and sandboxes allocated from them
+void slab_stats(long *slabs, long *in_use);
+
+/// @brief Reset the depot locks in the child of a fork()
+void slab_atfork_child();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_SLAB_H
@@ -0,0 +1,189 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_slo.h"
+
+#include <pthread.h>
+#include "psandbox_internal.h"
+
+#define SLO_WINDOW 512          // samples per control decision
+#define SLO_BUCKETS 256         // quarter-octave latency histogram
+#define SLO_TIGHTEN 1.05        // lower the level above this share of the SLO
+#define SLO_LOOSEN 0.8          // raise it below this one
+#define SLO_MIN_INTERFERENCE 0.05 // lower it only if waiting on others matters
+#define SLO_GAIN 0.5            // share of the relative error applied per step
+#define SLO_MAX_STEP 10         // levels moved per step at most
+#define SLO_REST 1              // windows left alone after a change
+
+typedef struct sloClass {
+  IsolationRule rule;
+  long slo;
+  int min_level;
+  int max_level;
+  int rest;                // windows until the next change is allowed
+  pthread_mutex_t lock;    // serializes the end of a window
+  long samples;
+  long latency_sum;
+  long interference_sum;
+  unsigned int buckets[SLO_BUCKETS];
+} SloClass;
+
+int slo_enabled = 0;
+static pthread_mutex_t slo_lock = PTHREAD_MUTEX_INITIALIZER;
+static SloClass slo_classes[PSANDBOX_SLO_CLASSES];
+static int slo_class_count = 0;
+
+static inline int bucket_of(long ns) {
+  int bits;
+
+  if (ns < 4)
+    return ns < 0 ? 0 : (int) ns;
+  bits = 63 - __builtin_clzl(ns);
+  return bits * 4 + (int) ((ns >> (bits - 2)) & 3);
+}
+
+/// @return The largest latency that falls in the bucket
+static inline long bucket_value(int bucket) {
+  int bits = bucket / 4;
+
+  if (bucket < 8)
+    return bucket;
+  return ((long) (4 + bucket % 4 + 1) << (bits - 2)) - 1;
+}
+
+int psandbox_slo_class(IsolationRule rule, long slo_ns, int min_level,
+                       int max_level) {
+  SloClass *slo_class;
+  int id;
+
+  pthread_mutex_lock(&slo_lock);
+  if (slo_class_count == PSANDBOX_SLO_CLASSES) {
+    pthread_mutex_unlock(&slo_lock);
+    return -1;
+  }
+  id = slo_class_count;
+  slo_class = &slo_classes[id];
+  slo_class->rule = normalize_rule(rule);
+  if (slo_class->rule.isolation_level < min_level)
+    slo_class->rule.isolation_level = min_level;
+  if (slo_class->rule.isolation_level > max_level)
+    slo_class->rule.isolation_level = max_level;
+  slo_class->slo = slo_ns;
+  slo_class->min_level = min_level;
+  slo_class->max_level = max_level;
+  slo_class->rest = 0;
+  pthread_mutex_init(&slo_class->lock, NULL);
+  __atomic_store_n(&slo_class_count, id + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&slo_enabled, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&slo_lock);
+  return id;
+}
+
+static inline SloClass *get_class(int slo_class) {
+  if (slo_class < 0 ||
+      slo_class >= __atomic_load_n(&slo_class_count, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &slo_classes[slo_class];
+}
+
+IsolationRule psandbox_slo_rule(int slo_class) {
+  SloClass *cls = get_class(slo_class);
+  IsolationRule rule;
+
+  if (!cls) {
+    rule.type = ISOLATION_DEFAULT;
+    return normalize_rule(rule);
+  }
+  rule = cls->rule;
+  rule.isolation_level =
+      __atomic_load_n(&cls->rule.isolation_level, __ATOMIC_RELAXED);
+  return rule;
+}
+
+int create_psandbox_slo(int slo_class) {
+  PSandbox *psandbox;
+  int id = create_psandbox(psandbox_slo_rule(slo_class));
+
+  if (id == -1 || !get_class(slo_class))
+    return id;
+  psandbox = psandbox_self();
+  if (psandbox) {
+    psandbox->slo_class = slo_class + 1;
+    psandbox->slo_level = psandbox->rule.isolation_level;
+  }
+  return id;
+}
+
+/// Decide on the level from one window of samples. Called with cls->lock.
+static void adjust_level(SloClass *cls, long p99, long latency_sum,
+                         long interference_sum) {
+  double ratio = (double) p99 / cls->slo;
+  double share = latency_sum ? (double) interference_sum / latency_sum : 0;
+  int level = cls->rule.isolation_level;
+  int step;
+
+  if (cls->rest) {
+    cls->rest--;
+    return;
+  }
+  if (ratio > SLO_TIGHTEN && share > SLO_MIN_INTERFERENCE)
+    step = -(int) ((ratio - 1) * SLO_GAIN * level + 1);
+  else if (ratio < SLO_LOOSEN)
+    step = (int) ((1 - ratio) * SLO_GAIN * level + 1);
+  else
+    return;
+
+  if (step > SLO_MAX_STEP)
+    step = SLO_MAX_STEP;
+  if (step < -SLO_MAX_STEP)
+    step = -SLO_MAX_STEP;
+  level += step;
+  if (level < cls->min_level)
+    level = cls->min_level;
+  if (level > cls->max_level)
+    level = cls->max_level;
+  if (level != cls->rule.isolation_level) {
+    __atomic_store_n(&cls->rule.isolation_level, level, __ATOMIC_RELAXED);
+    cls->rest = SLO_REST;
+  }
+}
+
+static void end_window(SloClass *cls) {
+  unsigned int counts[SLO_BUCKETS];
+  long total = 0, seen = 0, latency_sum, interference_sum;
+  int i;
+
+  pthread_mutex_lock(&cls->lock);
+  for (i = 0; i < SLO_BUCKETS; i++) {
+    counts[i] = __atomic_exchange_n(&cls->buckets[i], 0, __ATOMIC_RELAXED);
+    total += counts[i];
+  }
+  latency_sum = __atomic_exchange_n(&cls->latency_sum, 0, __ATOMIC_RELAXED);
+  interference_sum =
+      __atomic_exchange_n(&cls->interference_sum, 0, __ATOMIC_RELAXED);
+  if (total) {
+    for (i = 0; i < SLO_BUCKETS; i++) {
+      seen += counts[i];
+      if (seen * 100 >= total * 99)
+        break;
+    }
+    adjust_level(cls, bucket_value(i), latency_sum, interference_sum);
+  }
+  pthread_mutex_unlock(&cls->lock);
+}
+
+void psandbox_slo_observe(int slo_class, long latency, long interference) {
+  SloClass *cls = get_class(slo_class);
+
+  if (!cls)
+    return;
+  __atomic_add_fetch(&cls->buckets[bucket_of(latency)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&cls->latency_sum, latency, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&cls->interference_sum, interference, __ATOMIC_RELAXED);
+  if (__atomic_add_fetch(&cls->samples, 1, __ATOMIC_RELAXED) % SLO_WINDOW == 0)
+    end_window(cls);
+}
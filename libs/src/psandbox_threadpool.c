@@ -0,0 +1,250 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "../include/psandbox_threadpool.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "psandbox_internal.h"
+#include "psandbox_waitq.h"
+
+static __thread PSandboxWorker *current_worker;
+
+/// @return 1 if task a is more urgent than task b
+static inline int task_before(const PSandboxTask *a, const PSandboxTask *b) {
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  return a->arrival < b->arrival;
+}
+
+static void unlink_task(PSandboxWorker *worker, PSandboxTask *task,
+                        PSandboxTask *prev) {
+  if (prev)
+    prev->next = task->next;
+  else
+    worker->head = task->next;
+  if (worker->tail == task)
+    worker->tail = prev;
+  task->next = NULL;
+}
+
+static void push_task(PSandboxWorker *worker, PSandboxTask *task) {
+  pthread_mutex_lock(&worker->lock);
+  if (worker->tail)
+    worker->tail->next = task;
+  else
+    worker->head = task;
+  worker->tail = task;
+  pthread_mutex_unlock(&worker->lock);
+}
+
+static PSandboxTask *take_own(PSandboxWorker *self) {
+  PSandboxTask *task;
+
+  pthread_mutex_lock(&self->lock);
+  task = self->head;
+  if (task)
+    unlink_task(self, task, NULL);
+  pthread_mutex_unlock(&self->lock);
+  return task;
+}
+
+/// Find the most urgent task queued at another worker. Tasks whose sandbox
+/// that worker still has bound are skipped: it is going to run them next
+/// without a rebind, and the sandbox could not be bound here anyway.
+static PSandboxTask *steal(psandbox_threadpool_t *pool, PSandboxWorker *self) {
+  PSandboxTask *best, *task, *prev;
+  PSandboxWorker *victim, *best_victim;
+  int i;
+
+retry:
+  best = NULL;
+  best_victim = NULL;
+  for (i = 0; i < pool->nworkers; i++) {
+    victim = &pool->workers[i];
+    if (victim == self || !__atomic_load_n(&victim->head, __ATOMIC_RELAXED))
+      continue;
+    pthread_mutex_lock(&victim->lock);
+    for (task = victim->head; task; task = task->next) {
+      if (task->psandbox && task->psandbox == victim->bound)
+        continue;
+      if (!best || task_before(task, best)) {
+        best = task;
+        best_victim = victim;
+      }
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  if (!best)
+    return NULL;
+
+  // The victim may have run the task in the meantime.
+  pthread_mutex_lock(&best_victim->lock);
+  for (prev = NULL, task = best_victim->head; task; prev = task,
+       task = task->next) {
+    if (task == best && !(task->psandbox &&
+                          task->psandbox == best_victim->bound)) {
+      unlink_task(best_victim, task, prev);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&best_victim->lock);
+  if (!task)
+    goto retry;
+  return task;
+}
+
+static void set_bound(PSandboxWorker *self, int psandbox) {
+  pthread_mutex_lock(&self->lock);
+  self->bound = psandbox;
+  pthread_mutex_unlock(&self->lock);
+}
+
+static void unbind_current(PSandboxWorker *self) {
+  int psandbox = self->bound;
+
+  if (!psandbox)
+    return;
+  set_bound(self, 0);
+  unbind_psandbox(psandbox_park_key(psandbox), psandbox, UNBIND_NONE);
+}
+
+static void run_task(PSandboxWorker *self, PSandboxTask *task) {
+  int keep;
+
+  if (task->psandbox != self->bound) {
+    unbind_current(self);
+    if (task->psandbox && bind_psandbox(psandbox_park_key(task->psandbox)) != -1)
+      set_bound(self, task->psandbox);
+  }
+
+  task->fn(task->arg);
+  free(task);
+
+  // Keep the sandbox if the next task in line runs in it too.
+  pthread_mutex_lock(&self->lock);
+  keep = self->bound && self->head && self->head->psandbox == self->bound;
+  pthread_mutex_unlock(&self->lock);
+  if (!keep)
+    unbind_current(self);
+}
+
+static void* worker_main(void *arg) {
+  PSandboxWorker *self = (PSandboxWorker *) arg;
+  psandbox_threadpool_t *pool = self->pool;
+  PSandboxTask *task;
+  int seq;
+
+  current_worker = self;
+  for (;;) {
+    seq = __atomic_load_n(&pool->seq, __ATOMIC_SEQ_CST);
+    task = take_own(self);
+    if (!task)
+      task = steal(pool, self);
+    if (task) {
+      run_task(self, task);
+      continue;
+    }
+    unbind_current(self);
+    if (__atomic_load_n(&pool->stop, __ATOMIC_SEQ_CST))
+      break;
+    __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+    futex_wait(&pool->seq, seq, NULL);
+    __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+  }
+  return 0;
+}
+
+int psandbox_threadpool_init(psandbox_threadpool_t *pool, int nworkers) {
+  int i, ret;
+
+  if (nworkers <= 0)
+    return EINVAL;
+  pool->workers = (PSandboxWorker *) calloc(nworkers, sizeof(PSandboxWorker));
+  if (!pool->workers)
+    return ENOMEM;
+  pool->nworkers = nworkers;
+  pool->next = 0;
+  pool->seq = 0;
+  pool->idle = 0;
+  pool->stop = 0;
+
+  for (i = 0; i < nworkers; i++) {
+    pthread_mutex_init(&pool->workers[i].lock, NULL);
+    pool->workers[i].pool = pool;
+  }
+  for (i = 0; i < nworkers; i++) {
+    ret = pthread_create(&pool->workers[i].thread, NULL, worker_main,
+                         &pool->workers[i]);
+    if (ret) {
+      pool->nworkers = i;
+      psandbox_threadpool_destroy(pool);
+      return ret;
+    }
+  }
+  return 0;
+}
+
+void psandbox_threadpool_destroy(psandbox_threadpool_t *pool) {
+  int i;
+
+  __atomic_store_n(&pool->stop, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&pool->seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&pool->seq, INT_MAX);
+  for (i = 0; i < pool->nworkers; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool->workers[i].lock);
+  }
+  free(pool->workers);
+  pool->workers = NULL;
+}
+
+int psandbox_threadpool_submit(psandbox_threadpool_t *pool,
+                               psandbox_task_fn fn, void *arg) {
+  PSandboxWorker *worker = current_worker;
+  PSandboxTask *task;
+  PSandbox *psandbox;
+
+  task = (PSandboxTask *) malloc(sizeof(PSandboxTask));
+  if (!task)
+    return ENOMEM;
+  task->next = NULL;
+  task->fn = fn;
+  task->arg = arg;
+  task->psandbox = 0;
+  task->priority = LOW_PRIORITY;
+  task->arrival = waitq_now();
+
+  psandbox = psandbox_self();
+  if (psandbox) {
+    task->priority = psandbox->rule.priority;
+    task->arrival -= psandbox->wait_time;
+  }
+
+  if (worker && worker->pool == pool) {
+    // A continuation: it stays with this worker and its sandbox, which the
+    // worker still has bound when the task comes up next.
+    task->psandbox = worker->bound;
+  } else {
+    worker = &pool->workers[__atomic_fetch_add(&pool->next, 1,
+                                               __ATOMIC_RELAXED) %
+                            pool->nworkers];
+    task->psandbox = psandbox_self_id();
+    if (task->psandbox &&
+        unbind_psandbox(psandbox_park_key(task->psandbox), task->psandbox,
+                        UNBIND_NONE) < 0)
+      task->psandbox = 0;
+  }
+
+  push_task(worker, task);
+  // A worker that goes idle after the bump sees the task or a changed seq.
+  __atomic_add_fetch(&pool->seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST))
+    futex_wake(&pool->seq, 1);
+  return 0;
+}
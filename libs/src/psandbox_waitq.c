@@ -0,0 +1,95 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+#include "psandbox_waitq.h"
+
+#include <errno.h>
+
+/// @return 1 if a should run before b
+static inline int waiter_before(const PSandboxWaiter *a,
+                                const PSandboxWaiter *b) {
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  if (a->deadline != b->deadline) {
+    if (!a->deadline || !b->deadline)
+      return a->deadline != 0;
+    return a->deadline < b->deadline;
+  }
+  return a->arrival < b->arrival;
+}
+
+void waiter_init(PSandboxWaiter *waiter) {
+  PSandbox *psandbox = psandbox_self();
+
+  waiter->next = NULL;
+  waiter->state = 0;
+  waiter->start = waitq_now();
+  waiter->psandbox = psandbox;
+  waiter->deadline = 0;
+  if (psandbox) {
+    if (psandbox->rule.type == DEADLINE)
+      waiter->deadline = psandbox->deadline;
+    waiter->priority = psandbox->rule.priority;
+    waiter->arrival = waiter->start - psandbox->wait_time;
+  } else {
+    waiter->priority = LOW_PRIORITY;
+    waiter->arrival = waiter->start;
+  }
+}
+
+int waiter_sleep(PSandboxWaiter *waiter, const struct timespec *abstime) {
+  int ret = 0;
+
+  while (__atomic_load_n(&waiter->state, __ATOMIC_ACQUIRE) == 0) {
+    if (futex_wait(&waiter->state, 0, abstime) == -1 && errno == ETIMEDOUT) {
+      ret = ETIMEDOUT;
+      break;
+    }
+  }
+
+  // Between PREPARE and ENTER the wait is charged at ENTER.
+  if (waiter->psandbox && !waiter->psandbox->wait_start)
+    waiter->psandbox->wait_time += waitq_now() - waiter->start;
+  return ret;
+}
+
+void waiter_wake(PSandboxWaiter *waiter) {
+  __atomic_store_n(&waiter->state, 1, __ATOMIC_RELEASE);
+  // waiter may be gone from here on; the wake only uses its address.
+  futex_wake(&waiter->state, 1);
+}
+
+void waitq_insert(PSandboxWaiter **queue, PSandboxWaiter *waiter) {
+  PSandboxWaiter **pos = queue;
+
+  while (*pos && !waiter_before(waiter, *pos)) {
+    pos = &(*pos)->next;
+  }
+  waiter->next = *pos;
+  *pos = waiter;
+}
+
+PSandboxWaiter *waitq_pop(PSandboxWaiter **queue) {
+  PSandboxWaiter *waiter = *queue;
+
+  if (waiter)
+    *queue = waiter->next;
+  return waiter;
+}
+
+int waitq_remove(PSandboxWaiter **queue, PSandboxWaiter *waiter) {
+  PSandboxWaiter **pos = queue;
+
+  while (*pos) {
+    if (*pos == waiter) {
+      *pos = waiter->next;
+      return 1;
+    }
+    pos = &(*pos)->next;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Sandbox-ordered wait queues for the blocking primitives. Each waiter sleeps
+// on its own futex word, so the waker picks exactly which thread runs next.
+// Waiters are ordered by sandbox priority, then DEADLINE sandboxes by their
+// deadline, earliest first, ahead of the others, then by effective arrival:
+// the enqueue time minus the delay the sandbox already suffered. None of
+// these change while a waiter sleeps, so the queue is kept sorted on insert
+// and the next waiter is always at the head.
+//
+// Queues are not synchronized; the owner protects them with its own lock.
+
+#ifndef PSANDBOX_USERLIB_PSANDBOX_WAITQ_H
+#define PSANDBOX_USERLIB_PSANDBOX_WAITQ_H
+
+#include <time.h>
+#include "psandbox_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct psandboxWaiter {
+  struct psandboxWaiter *next;
+  int state;      // futex word, set to 1 once the waiter is handed a wake up
+  int priority;
+  long arrival;   // ns, enqueue time minus the sandbox's past wait_time
+  long start;     // ns, when the waiter was initialized
+  long deadline;  // ns, when the DEADLINE sandbox's activity is due, or 0
+  PSandbox *psandbox;
+} PSandboxWaiter;
+
+/// @brief Prepare a waiter for the calling thread and its sandbox
+void waiter_init(PSandboxWaiter *waiter);
+
+/// @brief Sleep until the waiter is woken or abstime passes
+/// @param abstime A CLOCK_REALTIME deadline, or NULL to wait forever.
+/// @return 0 when woken, ETIMEDOUT otherwise.
+///
+/// The time spent here is charged to the sandbox's wait_time, unless the
+/// caller emitted PREPARE before, in which case ENTER charges it.
+int waiter_sleep(PSandboxWaiter *waiter, const struct timespec *abstime);
+
+/// @brief Wake a waiter that has been taken off its queue
+///
+/// Must be called with the queue's lock held. A waiter that times out takes
+/// that lock to find out whether it was popped, so it cannot return and free
+/// its stack before the store. Nothing keeps it there after the store,
+/// though: a waiter that sees the state may return before the futex_wake,
+/// which then only ever wakes a stale address.
+void waiter_wake(PSandboxWaiter *waiter);
+
+/// @brief Insert a waiter at its position in the queue
+void waitq_insert(PSandboxWaiter **queue, PSandboxWaiter *waiter);
+
+/// @brief Take the waiter that should run next off the queue
+/// @return The waiter, or NULL if the queue is empty
+PSandboxWaiter *waitq_pop(PSandboxWaiter **queue);
+
+/// @brief Remove a waiter that gave up waiting
+/// @return 1 if it was still queued, 0 if somebody already popped it
+int waitq_remove(PSandboxWaiter **queue, PSandboxWaiter *waiter);
+
+/// @brief Monotonic clock in nanoseconds
+static inline long waitq_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return time2ns(now);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PSANDBOX_USERLIB_PSANDBOX_WAITQ_H
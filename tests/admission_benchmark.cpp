@@ -0,0 +1,108 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A saturated server: CLIENTS clients send requests back to back, each in a
+// new sandbox holding one hot key for HOLD_US. A rejected client backs off
+// for BACKOFF_US before trying again. Reported, with admission control off
+// and on (5ms target, 100ms interval): admitted requests per second, the
+// share rejected, and the admitted requests' median and 99th percentile
+// latency in us.
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include "psandbox.h"
+#include "psandbox_admission.h"
+#include "psandbox_keylock.h"
+
+#define CLIENTS 32
+#define DURATION_MS 5000
+#define HOLD_US 250
+#define BACKOFF_US 20000
+#define MAX_REQUESTS 20000  // per client
+
+static int key;
+static volatile int running;
+
+typedef struct benchArg {
+  long admitted;
+  long rejected;
+  long latency[MAX_REQUESTS];
+} BenchArg;
+
+static BenchArg args[CLIENTS];
+static long latency[CLIENTS * MAX_REQUESTS];
+
+static void* do_client(void *arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  struct timespec start, stop;
+  IsolationRule rule;
+  int id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  while (running && bench->admitted < MAX_REQUESTS) {
+    DBUG_TRACE(&start);
+    id = create_psandbox(rule);
+    if (id == -1 && errno == EAGAIN) {
+      bench->rejected++;
+      usleep(BACKOFF_US);
+      continue;
+    }
+    activate_psandbox(id);
+    psandbox_key_lock((size_t) &key);
+    usleep(HOLD_US);
+    psandbox_key_unlock((size_t) &key);
+    freeze_psandbox(id);
+    release_psandbox(id);
+    DBUG_TRACE(&stop);
+    bench->latency[bench->admitted++] = time2ns(timeDiff(start, stop));
+  }
+  return NULL;
+}
+
+static void run(const char *name) {
+  pthread_t tid[CLIENTS];
+  long admitted = 0, rejected = 0;
+  int i;
+
+  running = 1;
+  for (i = 0; i < CLIENTS; i++) {
+    args[i].admitted = 0;
+    args[i].rejected = 0;
+    pthread_create(&tid[i], NULL, do_client, &args[i]);
+  }
+  usleep(DURATION_MS * 1000);
+  running = 0;
+  for (i = 0; i < CLIENTS; i++) {
+    pthread_join(tid[i], NULL);
+    std::copy(args[i].latency, args[i].latency + args[i].admitted,
+              latency + admitted);
+    admitted += args[i].admitted;
+    rejected += args[i].rejected;
+  }
+  std::sort(latency, latency + admitted);
+  printf("%s, %.0f, %.1f, %lu, %lu\n", name, admitted * 1000.0 / DURATION_MS,
+         100.0 * rejected / (admitted + rejected), latency[admitted / 2] / 1000,
+         latency[admitted * 99 / 100] / 1000);
+}
+
+int main() {
+  printf("admission, admitted/s, rejected %%, p50 us, p99 us\n");
+  run("off");
+  if (psandbox_admission_enable(5000000, 100000000, 0)) {
+    printf("can't enable admission control\n");
+    return 1;
+  }
+  run("codel");
+  return 0;
+}
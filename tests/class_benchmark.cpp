@@ -0,0 +1,110 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Rule lookups by class name while an operator retunes the classes: 1 to
+// MAX_THREAD threads resolve "oltp_read" in a loop for DURATION_MS, with the
+// file left alone or replaced every RELOAD_MS with another isolation level.
+// Reported: ns per lookup, and how many level changes the lookups saw.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "psandbox.h"
+#include "psandbox_class.h"
+
+#define MAX_THREAD 8
+#define DURATION_MS 500
+#define RELOAD_MS 10
+
+static char path[64];
+static volatile int running;
+
+typedef struct benchArg {
+  long lookups;
+  long changes;
+} BenchArg;
+
+static void write_classes(int level) {
+  char temp[80];
+  FILE *file;
+
+  snprintf(temp, sizeof(temp), "%s.new", path);
+  file = fopen(temp, "w");
+  fprintf(file, "# name        type      level  priority  [retro]\n");
+  fprintf(file, "oltp_read     RELATIVE  %d     2\n", level);
+  fprintf(file, "batch_report  SCALABLE  100    0\n");
+  fprintf(file, "admin         ABSOLUTE  10     1         retro\n");
+  fclose(file);
+  rename(temp, path);
+}
+
+static void* do_lookup(void *arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  IsolationRule rule;
+  int last = -1;
+
+  while (running) {
+    psandbox_class_rule("oltp_read", &rule);
+    if (rule.isolation_level != last) {
+      bench->changes += last != -1;
+      last = rule.isolation_level;
+    }
+    bench->lookups++;
+  }
+  return NULL;
+}
+
+static void run(int threads, int reload) {
+  pthread_t tid[MAX_THREAD];
+  BenchArg arg[MAX_THREAD] = {};
+  struct timespec start, stop;
+  long lookups = 0, changes = 0;
+  int i, round;
+
+  running = 1;
+  DBUG_TRACE(&start);
+  for (i = 0; i < threads; i++)
+    pthread_create(&tid[i], NULL, do_lookup, &arg[i]);
+  for (round = 0; round < DURATION_MS / RELOAD_MS; round++) {
+    usleep(RELOAD_MS * 1000);
+    if (reload)
+      write_classes(round % 2 ? 30 : 60);
+  }
+  running = 0;
+  for (i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+    lookups += arg[i].lookups;
+    changes += arg[i].changes;
+  }
+  DBUG_TRACE(&stop);
+  printf("%d, %s, %.1f, %lu\n", threads, reload ? "yes" : "no",
+         (double) time2ns(timeDiff(start, stop)) * threads / lookups,
+         changes / threads);
+}
+
+int main() {
+  char directory[] = "/tmp/psandbox_classXXXXXX";
+  int threads;
+
+  if (!mkdtemp(directory))
+    return 1;
+  snprintf(path, sizeof(path), "%s/classes.conf", directory);
+  write_classes(30);
+  if (psandbox_class_load(path))
+    return 1;
+
+  printf("threads, reloading, ns per lookup, changes seen\n");
+  for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+    run(threads, false);
+    run(threads, true);
+  }
+  unlink(path);
+  rmdir(directory);
+  return 0;
+}
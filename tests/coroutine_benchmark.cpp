@@ -0,0 +1,141 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// 100k concurrent coroutines, each in its own sandbox, multiplexed on one
+// thread. Every coroutine yields YIELDS times. The scheduler either resumes
+// in FIFO order (every resume switches sandbox) or LIFO order (a coroutine is
+// resumed back to back). Sandboxes are parked on every suspend (coroutines
+// that may migrate) or only when another sandbox needs the thread
+// (thread-affine coroutines). Reported: ns per resume and bind/unbind/switch
+// calls.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <coroutine>
+#include <deque>
+#include "psandbox.h"
+#include "psandbox_coro.hpp"
+
+#define COROUTINES 100000
+#define YIELDS 10
+
+enum SandboxMode { NO_SANDBOX, MIGRATING, THREAD_AFFINE };
+
+static long binds = 0, unbinds = 0, switches = 0;
+
+struct CountingPolicy : psandbox::DefaultPolicy {
+  static int unbind(size_t key, int id, enum enum_unbind_flag flags) {
+    unbinds++;
+    return psandbox::DefaultPolicy::unbind(key, id, flags);
+  }
+  static int bind(size_t key) {
+    binds++;
+    return psandbox::DefaultPolicy::bind(key);
+  }
+  static int switch_to(int from, int to) {
+    switches++;
+    return psandbox::DefaultPolicy::switch_to(from, to);
+  }
+};
+
+typedef psandbox::CoroContext<CountingPolicy> Context;
+
+static std::deque<std::coroutine_handle<> > ready;
+static bool lifo = false;
+
+struct Task {
+  struct promise_type : psandbox::SandboxPromise<CountingPolicy> {
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { abort(); }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+struct Yield {
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { ready.push_back(handle); }
+  void await_resume() {}
+};
+
+static Task handle_request(enum SandboxMode mode) {
+  IsolationRule rule;
+  int id = -1;
+  int i;
+
+  if (mode != NO_SANDBOX) {
+    rule.priority = 0;
+    rule.isolation_level = 50;
+    rule.type = RELATIVE;
+    rule.is_retro = false;
+    id = Context::create(rule);
+    co_await psandbox::adopt(id, mode == THREAD_AFFINE);
+    activate_psandbox(id);
+  }
+  for (i = 0; i < YIELDS; i++) {
+    co_await Yield();
+  }
+  if (id != -1) {
+    freeze_psandbox(id);
+    Context::release(id);
+  }
+}
+
+static void run(enum SandboxMode mode, bool use_lifo) {
+  struct timespec start, stop;
+  long resumes = 0;
+  int i;
+
+  lifo = use_lifo;
+  binds = 0;
+  unbinds = 0;
+  switches = 0;
+  DBUG_TRACE(&start);
+  for (i = 0; i < COROUTINES; i++) {
+    ready.push_back(handle_request(mode).handle);
+  }
+  while (!ready.empty()) {
+    std::coroutine_handle<> handle;
+
+    if (lifo) {
+      handle = ready.back();
+      ready.pop_back();
+    } else {
+      handle = ready.front();
+      ready.pop_front();
+    }
+    handle.resume();
+    resumes++;
+    if (handle.done())
+      handle.destroy();
+  }
+  Context::park_bound();
+  DBUG_TRACE(&stop);
+
+  printf("%s, %s, %lu, %lu, %lu, %lu\n",
+         mode == NO_SANDBOX ? "none" :
+         mode == MIGRATING ? "migrating" : "thread-affine",
+         use_lifo ? "lifo" : "fifo",
+         time2ns(timeDiff(start, stop)) / resumes, binds, unbinds, switches);
+}
+
+int main() {
+  printf("sandbox, order, ns/resume, binds, unbinds, switches\n");
+  run(NO_SANDBOX, false);
+  run(MIGRATING, false);
+  run(THREAD_AFFINE, false);
+  run(NO_SANDBOX, true);
+  run(MIGRATING, true);
+  run(THREAD_AFFINE, true);
+  return 0;
+}
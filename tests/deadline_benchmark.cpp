@@ -0,0 +1,95 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// An overloaded key: THREADS connections each run requests that hold the key
+// for HOLD_US (say, a read from disk under the lock), half of them due in
+// TIGHT_NS and half in LOOSE_NS. The key
+// is arbitrated by arrival (RELATIVE sandboxes) or earliest deadline first
+// (DEADLINE sandboxes). Reported: the deadline-miss rate of each half and as
+// counted by the library.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "psandbox.h"
+#include "psandbox_keylock.h"
+
+#define THREADS 16
+#define NUMBER 500  // requests per connection
+#define HOLD_US 250
+#define TIGHT_NS 4000000L
+#define LOOSE_NS 30000000L
+
+static int key;
+
+typedef struct benchArg {
+  enum enum_isolation_type type;
+  long deadline;
+  long misses;
+} BenchArg;
+
+static void* do_handle_one_connection(void *arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  struct timespec start, stop;
+  IsolationRule rule;
+  int i, id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = bench->type;
+  rule.is_retro = false;
+  id = create_psandbox(rule);
+  for (i = 0; i < NUMBER; i++) {
+    DBUG_TRACE(&start);
+    activate_psandbox_deadline(id, bench->deadline);
+    psandbox_key_lock((size_t) &key);
+    usleep(HOLD_US);
+    psandbox_key_unlock((size_t) &key);
+    freeze_psandbox(id);
+    DBUG_TRACE(&stop);
+    bench->misses += time2ns(timeDiff(start, stop)) > bench->deadline;
+  }
+  release_psandbox(id);
+  return NULL;
+}
+
+static void run(const char *name, enum enum_isolation_type type) {
+  pthread_t tid[THREADS];
+  BenchArg arg[THREADS];
+  long tight = 0, loose = 0, activities, misses, base_activities, base_misses;
+  int i;
+
+  psandbox_deadline_stats(&base_activities, &base_misses);
+  for (i = 0; i < THREADS; i++) {
+    arg[i].type = type;
+    arg[i].deadline = i % 2 ? LOOSE_NS : TIGHT_NS;
+    arg[i].misses = 0;
+    pthread_create(&tid[i], NULL, do_handle_one_connection, &arg[i]);
+  }
+  for (i = 0; i < THREADS; i++) {
+    pthread_join(tid[i], NULL);
+    if (i % 2)
+      loose += arg[i].misses;
+    else
+      tight += arg[i].misses;
+  }
+  psandbox_deadline_stats(&activities, &misses);
+  printf("%s, %.1f, %.1f, %.1f\n", name,
+         100.0 * tight / (THREADS / 2 * NUMBER),
+         100.0 * loose / (THREADS / 2 * NUMBER),
+         activities > base_activities
+             ? 100.0 * (misses - base_misses) / (activities - base_activities)
+             : 0);
+}
+
+int main() {
+  printf("arbitration, tight miss %%, loose miss %%, library miss %%\n");
+  run("arrival", RELATIVE);
+  run("earliest deadline", DEADLINE);
+  return 0;
+}
@@ -0,0 +1,59 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// release_psandbox vs. release_psandbox_deferred as seen by the releasing
+// thread: average, 99th percentile and worst latency of the call, and the
+// time until every sandbox is really gone (the reaper included).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "psandbox.h"
+
+#define NUMBER 100000
+
+static long latency[NUMBER];
+
+static void run(int deferred) {
+  struct timespec start, stop, begin, end;
+  IsolationRule rule;
+  long total = 0;
+  int i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  DBUG_TRACE(&begin);
+  for (i = 0; i < NUMBER; i++) {
+    int id = create_psandbox(rule);
+
+    DBUG_TRACE(&start);
+    if (deferred)
+      release_psandbox_deferred(id);
+    else
+      release_psandbox(id);
+    DBUG_TRACE(&stop);
+    latency[i] = time2ns(timeDiff(start, stop));
+    total += latency[i];
+  }
+  psandbox_reaper_flush();
+  DBUG_TRACE(&end);
+
+  std::sort(latency, latency + NUMBER);
+  printf("%s, %lu, %lu, %lu, %lu\n", deferred ? "deferred" : "release",
+         total / NUMBER, latency[NUMBER * 99 / 100], latency[NUMBER - 1],
+         time2ms(timeDiff(begin, end)));
+}
+
+int main() {
+  printf("mode, avg ns, p99 ns, max ns, total ms\n");
+  run(false);
+  run(true);
+  return 0;
+}
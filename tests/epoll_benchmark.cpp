@@ -0,0 +1,166 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// An epoll echo server on one thread serving CONNECTIONS Unix socket
+// connections, each with its own sandbox. Around every callback the loop
+// either does nothing with the sandboxes, unbinds/binds them by hand, or
+// calls psandbox_switch. A client thread keeps one request in flight per
+// connection. Reported: requests per second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "psandbox.h"
+
+#define CONNECTIONS 64
+#define ROUNDS 2000
+#define MESSAGE_SIZE 64
+
+enum SwitchMode { NO_SWITCH, BIND_UNBIND, SWITCH };
+
+typedef struct connection {
+  int server_fd;
+  int client_fd;
+  int psandbox;
+} Connection;
+
+static Connection connections[CONNECTIONS];
+
+static void* do_client(void *) {
+  char buffer[MESSAGE_SIZE];
+  int i, round;
+
+  memset(buffer, 'x', sizeof(buffer));
+  for (round = 0; round < ROUNDS; round++) {
+    for (i = 0; i < CONNECTIONS; i++) {
+      if (write(connections[i].client_fd, buffer, sizeof(buffer)) < 0)
+        return 0;
+    }
+    for (i = 0; i < CONNECTIONS; i++) {
+      size_t got = 0;
+      while (got < sizeof(buffer)) {
+        ssize_t n = read(connections[i].client_fd, buffer + got,
+                         sizeof(buffer) - got);
+        if (n <= 0)
+          return 0;
+        got += n;
+      }
+    }
+  }
+  for (i = 0; i < CONNECTIONS; i++)
+    shutdown(connections[i].client_fd, SHUT_WR);
+  return 0;
+}
+
+static void serve(enum SwitchMode mode) {
+  struct epoll_event events[CONNECTIONS];
+  int epoll_fd = epoll_create1(0);
+  int open = CONNECTIONS;
+  int current = 0;
+  int i;
+
+  for (i = 0; i < CONNECTIONS; i++) {
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &connections[i];
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connections[i].server_fd, &event);
+  }
+
+  while (open > 0) {
+    int ready = epoll_wait(epoll_fd, events, CONNECTIONS, -1);
+
+    for (i = 0; i < ready; i++) {
+      Connection *connection = (Connection *) events[i].data.ptr;
+      char buffer[MESSAGE_SIZE * 4];
+      ssize_t n;
+
+      if (mode == BIND_UNBIND) {
+        bind_psandbox(psandbox_park_key(connection->psandbox));
+      } else if (mode == SWITCH) {
+        if (psandbox_switch(current, connection->psandbox)) {
+          printf("can't switch from sandbox %d to %d\n", current,
+                 connection->psandbox);
+          abort();
+        }
+        current = connection->psandbox;
+      }
+
+      n = read(connection->server_fd, buffer, sizeof(buffer));
+      if (n > 0) {
+        if (write(connection->server_fd, buffer, n) < 0)
+          n = 0;
+      }
+      if (n <= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->server_fd, NULL);
+        open--;
+      }
+
+      if (mode == BIND_UNBIND)
+        unbind_psandbox(psandbox_park_key(connection->psandbox),
+                        connection->psandbox, UNBIND_NONE);
+    }
+  }
+  if (mode == SWITCH && psandbox_switch(current, 0)) {
+    printf("can't switch sandbox %d out\n", current);
+    abort();
+  }
+  close(epoll_fd);
+}
+
+static void run(enum SwitchMode mode) {
+  struct timespec start, stop;
+  IsolationRule rule;
+  pthread_t client;
+  int i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  for (i = 0; i < CONNECTIONS; i++) {
+    int fds[2];
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    connections[i].server_fd = fds[0];
+    connections[i].client_fd = fds[1];
+    connections[i].psandbox = create_psandbox(rule);
+    unbind_psandbox(psandbox_park_key(connections[i].psandbox),
+                    connections[i].psandbox, UNBIND_NONE);
+  }
+
+  DBUG_TRACE(&start);
+  pthread_create(&client, NULL, do_client, NULL);
+  serve(mode);
+  pthread_join(client, NULL);
+  DBUG_TRACE(&stop);
+
+  for (i = 0; i < CONNECTIONS; i++) {
+    bind_psandbox(psandbox_park_key(connections[i].psandbox));
+    release_psandbox(connections[i].psandbox);
+    close(connections[i].server_fd);
+    close(connections[i].client_fd);
+  }
+
+  printf("%s, %.0f\n",
+         mode == NO_SWITCH ? "none" :
+         mode == BIND_UNBIND ? "unbind/bind" : "psandbox_switch",
+         (double) CONNECTIONS * ROUNDS * 1e9 / time2ns(timeDiff(start, stop)));
+}
+
+int main() {
+  printf("per-callback switching, requests/s\n");
+  run(NO_SWITCH);
+  run(BIND_UNBIND);
+  run(SWITCH);
+  return 0;
+}
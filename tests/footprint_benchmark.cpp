@@ -0,0 +1,75 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Memory of many idle connections: NUMBER sandboxes, each having run one
+// activity that took and gave back a key, all alive at once. Reported: the
+// size of a PSandbox, the resident memory they add (in KB), the same after
+// releasing them all and creating NUMBER new ones, and bytes per sandbox.
+
+#include <stdio.h>
+#include "psandbox.h"
+
+#define NUMBER 100000
+
+static int ids[NUMBER];
+
+static long resident() {
+  long size, pages = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+
+  if (file) {
+    if (fscanf(file, "%ld %ld", &size, &pages) != 2)
+      pages = 0;
+    fclose(file);
+  }
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void create_all(IsolationRule rule) {
+  size_t key = 1000;
+  int i;
+
+  for (i = 0; i < NUMBER; i++) {
+    ids[i] = create_psandbox(rule);
+    activate_psandbox(ids[i]);
+    update_psandbox(key, PREPARE);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    update_psandbox(key, UNHOLD);
+    freeze_psandbox(ids[i]);
+  }
+}
+
+int main() {
+  IsolationRule rule;
+  long base, alive, again;
+  int i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+
+  // The sandbox map and the library's lazy state are not what is measured.
+  ids[0] = create_psandbox(rule);
+  release_psandbox(ids[0]);
+  base = resident();
+
+  create_all(rule);
+  alive = resident();
+  for (i = 0; i < NUMBER; i++)
+    release_psandbox(ids[i]);
+  create_all(rule);
+  again = resident();
+
+  printf("sandboxes, PSandbox bytes, alive KB, again KB, bytes per sandbox\n");
+  printf("%d, %zu, %ld, %ld, %ld\n", NUMBER, sizeof(PSandbox),
+         (alive - base) / 1024, (again - base) / 1024,
+         (alive - base) / NUMBER);
+  return 0;
+}
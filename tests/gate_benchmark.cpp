@@ -0,0 +1,159 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// srv_conc_enter_innodb as in queue_case.cpp (sleep-poll on n_active) vs. the
+// same admission control on top of psandbox_gate_t. Half of the connections
+// run in HIGHEST_PRIORITY sandboxes; admission latency is reported per class.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include "psandbox.h"
+#include "psandbox_gate.h"
+
+#define THREAD 8
+#define ROUNDS 200
+#define WORK_US 1000
+
+# define os_atomic_increment(ptr, amount) \
+	__sync_add_and_fetch(ptr, amount)
+
+# define os_atomic_decrement(ptr, amount) \
+	__sync_sub_and_fetch(ptr, amount)
+
+int n_active = 0;
+int srv_thread_concurrency = 2;
+int srv_thread_sleep_delay	= 10000;
+
+static psandbox_gate_t gate;
+
+typedef struct connectionArg {
+  int use_gate;
+  int priority;
+  long wait;      // total admission latency
+  long max_wait;
+} ConnectionArg;
+
+void
+os_thread_sleep(
+/*============*/
+    int	tm)	/*!< in: time in microseconds */
+{
+  struct timeval t;
+
+  t.tv_sec = tm / 1000000;
+  t.tv_usec = tm % 1000000;
+
+  select(0, NULL, NULL, NULL, &t);
+}
+
+void srv_conc_enter_innodb(){
+  update_psandbox((size_t)&n_active, PREPARE);
+
+  for (;;) {
+    int	sleep_in_us;
+
+    if (n_active < srv_thread_concurrency) {
+      int active = os_atomic_increment(
+          &n_active, 1);
+      if (active <= srv_thread_concurrency) {
+        update_psandbox((size_t)&n_active, ENTER);
+        return;
+      }
+      (void) os_atomic_decrement(
+          &n_active, 1);
+    }
+
+    sleep_in_us = srv_thread_sleep_delay;
+    os_thread_sleep(sleep_in_us);
+  }
+}
+
+void srv_conc_exit_innodb() {
+  (void) os_atomic_decrement(&n_active, 1);
+  update_psandbox((size_t)&n_active, UNHOLD);
+}
+
+void* do_handle_one_connection(void* arg) {
+  ConnectionArg *conn = (ConnectionArg *) arg;
+  struct timespec start, stop;
+  IsolationRule rule;
+  int i, id;
+
+  rule.priority = conn->priority;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  id = create_psandbox(rule);
+
+  for (i = 0; i < ROUNDS; i++) {
+    activate_psandbox(id);
+    DBUG_TRACE(&start);
+    if (conn->use_gate)
+      psandbox_gate_enter(&gate);
+    else
+      srv_conc_enter_innodb();
+    DBUG_TRACE(&stop);
+
+    os_thread_sleep(WORK_US);
+    if (conn->use_gate)
+      psandbox_gate_exit(&gate);
+    else
+      srv_conc_exit_innodb();
+    freeze_psandbox(id);
+
+    long time = time2ns(timeDiff(start, stop));
+    conn->wait += time;
+    if (time > conn->max_wait)
+      conn->max_wait = time;
+  }
+
+  release_psandbox(id);
+  return 0;
+}
+
+static void run(int use_gate) {
+  pthread_t threads[THREAD];
+  ConnectionArg arg[THREAD];
+  struct timespec start, stop;
+  long wait[2] = {0, 0}, max_wait[2] = {0, 0};
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < THREAD; i++) {
+    arg[i].use_gate = use_gate;
+    arg[i].priority = (i % 2) ? HIGHEST_PRIORITY : LOW_PRIORITY;
+    arg[i].wait = 0;
+    arg[i].max_wait = 0;
+    pthread_create(&threads[i], NULL, do_handle_one_connection, &arg[i]);
+  }
+  for (i = 0; i < THREAD; i++) {
+    pthread_join(threads[i], NULL);
+    wait[i % 2] += arg[i].wait;
+    if (arg[i].max_wait > max_wait[i % 2])
+      max_wait[i % 2] = arg[i].max_wait;
+  }
+  DBUG_TRACE(&stop);
+
+  const char *mode = use_gate ? "gate" : "sleep-poll";
+  long elapsed = time2ns(timeDiff(start, stop));
+  printf("%s throughput, %lu /s\n", mode,
+         (long) THREAD * ROUNDS * NSEC_PER_SEC / elapsed);
+  printf("%s low priority admission, avg %lu us, max %lu us\n", mode,
+         wait[0] / (THREAD / 2 * ROUNDS) / 1000, max_wait[0] / 1000);
+  printf("%s high priority admission, avg %lu us, max %lu us\n", mode,
+         wait[1] / (THREAD / 2 * ROUNDS) / 1000, max_wait[1] / 1000);
+}
+
+int main() {
+  psandbox_gate_init(&gate, srv_thread_concurrency);
+  run(false);
+  run(true);
+  psandbox_gate_destroy(&gate);
+  return 0;
+}
@@ -0,0 +1,131 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// THREADS threads taking turns on one key: a flag with the sleep-poll loop
+// of the *_case tests, a pthread mutex, and psandbox_key_lock handing the
+// key directly to the next waiter. Reported: time to acquire the key in ns
+// (average, 99th and 99.9th percentile, worst) and acquires per second.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include "psandbox.h"
+#include "psandbox_keylock.h"
+
+#define THREADS 64
+#define NUMBER 2000  // acquires per thread
+#define POLL_SLEEP_US 10
+#define CRITICAL_WORK 5000  // spins with the key held
+#define OUTSIDE_SLEEP_US 100  // e.g. waiting for the client
+
+enum Mode { MODE_POLL, MODE_MUTEX, MODE_KEYLOCK };
+
+static int flag;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static long latency[THREADS * NUMBER];
+static enum Mode mode;
+
+static void spin(int n) {
+  volatile int i;
+  for (i = 0; i < n; i++) {
+  }
+}
+
+static void acquire() {
+  int expected;
+
+  switch (mode) {
+    case MODE_POLL:
+      for (;;) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&flag, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+          break;
+        usleep(POLL_SLEEP_US);
+      }
+      break;
+    case MODE_MUTEX:
+      pthread_mutex_lock(&mutex);
+      break;
+    case MODE_KEYLOCK:
+      psandbox_key_lock((size_t) &flag);
+      break;
+  }
+}
+
+static void release() {
+  switch (mode) {
+    case MODE_POLL:
+      __atomic_store_n(&flag, 0, __ATOMIC_RELEASE);
+      break;
+    case MODE_MUTEX:
+      pthread_mutex_unlock(&mutex);
+      break;
+    case MODE_KEYLOCK:
+      psandbox_key_unlock((size_t) &flag);
+      break;
+  }
+}
+
+static void* do_handle_one_connection(void *arg) {
+  long *samples = (long *) arg;
+  struct timespec start, stop;
+  IsolationRule rule;
+  int i, id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  id = create_psandbox(rule);
+  for (i = 0; i < NUMBER; i++) {
+    activate_psandbox(id);
+    DBUG_TRACE(&start);
+    acquire();
+    DBUG_TRACE(&stop);
+    spin(CRITICAL_WORK);
+    release();
+    freeze_psandbox(id);
+    samples[i] = time2ns(timeDiff(start, stop));
+    usleep(OUTSIDE_SLEEP_US);
+  }
+  release_psandbox(id);
+  return NULL;
+}
+
+static void run(const char *name, enum Mode run_mode) {
+  pthread_t tid[THREADS];
+  struct timespec start, stop;
+  long total = 0, n = THREADS * NUMBER;
+  int i;
+
+  mode = run_mode;
+  DBUG_TRACE(&start);
+  for (i = 0; i < THREADS; i++)
+    pthread_create(&tid[i], NULL, do_handle_one_connection,
+                   &latency[i * NUMBER]);
+  for (i = 0; i < THREADS; i++)
+    pthread_join(tid[i], NULL);
+  DBUG_TRACE(&stop);
+
+  for (i = 0; i < n; i++)
+    total += latency[i];
+  std::sort(latency, latency + n);
+  printf("%s, %lu, %lu, %lu, %lu, %.0f\n", name, total / n,
+         latency[n * 99 / 100], latency[n * 999 / 1000], latency[n - 1],
+         (double) n * 1e9 / time2ns(timeDiff(start, stop)));
+}
+
+int main() {
+  printf("mode, avg ns, p99 ns, p99.9 ns, max ns, acquires/s\n");
+  run("sleep-poll", MODE_POLL);
+  run("pthread mutex", MODE_MUTEX);
+  run("key handoff", MODE_KEYLOCK);
+  return 0;
+}
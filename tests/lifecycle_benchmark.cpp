@@ -0,0 +1,159 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// End-to-end cost of a connection-per-thread (or per-process) request:
+// spawn -> create -> activate -> N updates -> freeze -> release -> exit,
+// compared against spawning a bare thread or process that does nothing.
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "psandbox.h"
+
+#define NUMBER  10000
+#define UPDATES 16
+
+enum enum_phase { CREATE, ACTIVATE, UPDATE, FREEZE, RELEASE, PHASE_NUM };
+
+static const char *phase_name[PHASE_NUM] = {"create", "activate", "update",
+                                            "freeze", "release"};
+
+typedef struct lifecycleStats {
+  long phase[PHASE_NUM];
+} LifecycleStats;
+
+static void* do_nothing(void* arg) {
+  (void) arg;
+  return 0;
+}
+
+static void do_lifecycle(LifecycleStats *stats) {
+  struct timespec t[PHASE_NUM + 1];
+  IsolationRule rule;
+  size_t key = 1000;
+  int id, i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+
+  DBUG_TRACE(&t[CREATE]);
+  id = create_psandbox(rule);
+  DBUG_TRACE(&t[ACTIVATE]);
+  activate_psandbox(id);
+  DBUG_TRACE(&t[UPDATE]);
+  for (i = 0; i < UPDATES; i++) {
+    update_psandbox(key, PREPARE);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    update_psandbox(key, UNHOLD);
+  }
+  DBUG_TRACE(&t[FREEZE]);
+  freeze_psandbox(id);
+  DBUG_TRACE(&t[RELEASE]);
+  release_psandbox(id);
+  DBUG_TRACE(&t[PHASE_NUM]);
+
+  for (i = 0; i < PHASE_NUM; i++) {
+    stats->phase[i] = time2ns(timeDiff(t[i], t[i + 1]));
+  }
+}
+
+static void* do_handle_one_connection(void* arg) {
+  do_lifecycle((LifecycleStats *) arg);
+  return 0;
+}
+
+static long run_threads(void* (*fn)(void*), LifecycleStats *stats) {
+  struct timespec start, stop;
+  pthread_t thread;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    pthread_create(&thread, NULL, fn, stats ? &stats[i] : NULL);
+    pthread_join(thread, NULL);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop));
+}
+
+static long run_processes(int with_psandbox, LifecycleStats *stats) {
+  struct timespec start, stop;
+  pid_t child;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    child = fork();
+    if (child == 0) {
+      if (with_psandbox)
+        do_lifecycle(&stats[i]);
+      _exit(0);
+    }
+    waitpid(child, NULL, 0);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop));
+}
+
+static void report(const char *mode, long bare, long total,
+                   LifecycleStats *stats) {
+  long phase[PHASE_NUM];
+  long accounted = 0;
+  int i, j;
+
+  memset(phase, 0, sizeof(phase));
+  for (i = 0; i < NUMBER; i++) {
+    for (j = 0; j < PHASE_NUM; j++) {
+      phase[j] += stats[i].phase[j];
+    }
+  }
+
+  printf("%s bare, %lu ns, %lu /s\n", mode, bare / NUMBER,
+         NUMBER * NSEC_PER_SEC / bare);
+  printf("%s lifecycle, %lu ns, %lu /s\n", mode, total / NUMBER,
+         NUMBER * NSEC_PER_SEC / total);
+  for (j = 0; j < PHASE_NUM; j++) {
+    accounted += phase[j];
+    printf("%s   %s, %lu ns\n", mode, phase_name[j], phase[j] / NUMBER);
+  }
+  // Whatever is left is spent outside of the library calls: the larger thread
+  // stack footprint, page faults on the calloc'ed sandbox and exit teardown.
+  printf("%s   other, %ld ns\n", mode,
+         (total - bare - accounted) / NUMBER);
+}
+
+int main() {
+  LifecycleStats *stats;
+  long bare, total;
+
+  // Shared so that forked children can hand their breakdown back.
+  stats = (LifecycleStats *) mmap(NULL, sizeof(LifecycleStats) * NUMBER,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  bare = run_threads(do_nothing, NULL);
+  total = run_threads(do_handle_one_connection, stats);
+  report("pthread", bare, total, stats);
+
+  memset(stats, 0, sizeof(LifecycleStats) * NUMBER);
+  bare = run_processes(false, NULL);
+  total = run_processes(true, stats);
+  report("fork", bare, total, stats);
+
+  munmap(stats, sizeof(LifecycleStats) * NUMBER);
+  return 0;
+}
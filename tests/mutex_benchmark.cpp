@@ -0,0 +1,98 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Raw pthread mutex vs. psandbox_mutex_t. Contention is varied by the number
+// of threads sharing one lock and by how much work each thread does outside
+// of the critical section.
+
+#include <stdio.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_mutex.h"
+
+#define NUMBER  1000000
+#define MAX_THREAD 8
+
+static pthread_mutex_t raw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static psandbox_mutex_t box_mutex = PSANDBOX_MUTEX_INITIALIZER;
+static volatile long counter = 0;
+
+typedef struct benchArg {
+  int use_psandbox;
+  int outside_work;
+} BenchArg;
+
+static void spin(int n) {
+  volatile int i;
+  for (i = 0; i < n; i++) {
+  }
+}
+
+static void* do_handle_one_connection(void* arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  IsolationRule rule;
+  int i, id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  id = create_psandbox(rule);
+  activate_psandbox(id);
+
+  for (i = 0; i < NUMBER; i++) {
+    if (bench->use_psandbox) {
+      psandbox_mutex_lock(&box_mutex);
+      counter++;
+      psandbox_mutex_unlock(&box_mutex);
+    } else {
+      pthread_mutex_lock(&raw_mutex);
+      counter++;
+      pthread_mutex_unlock(&raw_mutex);
+    }
+    spin(bench->outside_work);
+  }
+
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return 0;
+}
+
+static long run(int threads, int use_psandbox, int outside_work) {
+  pthread_t thread[MAX_THREAD];
+  BenchArg arg;
+  struct timespec start, stop;
+  int i;
+
+  arg.use_psandbox = use_psandbox;
+  arg.outside_work = outside_work;
+  DBUG_TRACE(&start);
+  for (i = 0; i < threads; i++) {
+    pthread_create(&thread[i], NULL, do_handle_one_connection, &arg);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(thread[i], NULL);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / ((long) threads * NUMBER);
+}
+
+int main() {
+  int outside[] = {0, 100, 1000};
+  int threads, j;
+
+  printf("threads, outside work, pthread ns/op, psandbox ns/op\n");
+  for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+    for (j = 0; j < (int) (sizeof(outside) / sizeof(outside[0])); j++) {
+      long raw = run(threads, false, outside[j]);
+      long box = run(threads, true, outside[j]);
+      printf("%d, %d, %lu, %lu\n", threads, outside[j], raw, box);
+    }
+  }
+  return 0;
+}
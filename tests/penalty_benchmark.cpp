@@ -0,0 +1,140 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A noisy neighbor holding a lock for long stretches against victims that
+// only need it briefly. While a victim waits it penalizes the holder for
+// every WAIT_SLICE_NS it waited, or not at all. Reported: victim average and
+// 99th percentile latency in ns, and the noisy neighbor's lock holds.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <algorithm>
+#include "psandbox.h"
+
+#define NUMBER 20000  // requests per victim
+#define VICTIMS 4
+#define NOISY_HOLD 200000  // spins
+#define WAIT_SLICE_NS 50000
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int stop_noisy;
+static long noisy_holds;
+static long latency[VICTIMS * NUMBER];
+
+static IsolationRule default_rule() {
+  IsolationRule rule;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return rule;
+}
+
+static void spin(int n) {
+  volatile int i;
+  for (i = 0; i < n; i++) {
+  }
+}
+
+static void* do_noisy(void *arg) {
+  size_t key = (size_t) &lock;
+  int id = create_psandbox(default_rule());
+
+  while (!stop_noisy) {
+    activate_psandbox(id);
+    update_psandbox(key, PREPARE);
+    pthread_mutex_lock(&lock);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    spin(NOISY_HOLD);
+    pthread_mutex_unlock(&lock);
+    update_psandbox(key, UNHOLD);
+    freeze_psandbox(id);
+    noisy_holds++;
+  }
+  release_psandbox(id);
+  return arg;
+}
+
+static void lock_penalizing(int penalize) {
+  struct timespec deadline;
+
+  if (!penalize) {
+    pthread_mutex_lock(&lock);
+    return;
+  }
+  for (;;) {
+    DBUG_TRACE(&deadline);
+    deadline.tv_nsec += WAIT_SLICE_NS;
+    if (deadline.tv_nsec >= NSEC_PER_SEC) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= NSEC_PER_SEC;
+    }
+    if (pthread_mutex_timedlock(&lock, &deadline) == 0)
+      return;
+    penalize_psandbox(WAIT_SLICE_NS, (size_t) &lock);
+  }
+}
+
+static void* do_victim(void *arg) {
+  long *samples = (long *) arg;
+  int penalize = samples[0];
+  size_t key = (size_t) &lock;
+  struct timespec start, stop;
+  int i, id = create_psandbox(default_rule());
+
+  for (i = 0; i < NUMBER; i++) {
+    DBUG_TRACE(&start);
+    activate_psandbox(id);
+    update_psandbox(key, PREPARE);
+    lock_penalizing(penalize);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    spin(100);
+    pthread_mutex_unlock(&lock);
+    update_psandbox(key, UNHOLD);
+    freeze_psandbox(id);
+    DBUG_TRACE(&stop);
+    samples[i] = time2ns(timeDiff(start, stop));
+  }
+  release_psandbox(id);
+  return NULL;
+}
+
+static void run(int penalize) {
+  pthread_t noisy, victims[VICTIMS];
+  long total = 0;
+  int i;
+
+  stop_noisy = 0;
+  noisy_holds = 0;
+  pthread_create(&noisy, NULL, do_noisy, NULL);
+  for (i = 0; i < VICTIMS; i++) {
+    latency[i * NUMBER] = penalize;
+    pthread_create(&victims[i], NULL, do_victim, &latency[i * NUMBER]);
+  }
+  for (i = 0; i < VICTIMS; i++)
+    pthread_join(victims[i], NULL);
+  stop_noisy = 1;
+  pthread_join(noisy, NULL);
+
+  for (i = 0; i < VICTIMS * NUMBER; i++)
+    total += latency[i];
+  std::sort(latency, latency + VICTIMS * NUMBER);
+  printf("%s, %lu, %lu, %lu\n", penalize ? "penalize" : "none",
+         total / (VICTIMS * NUMBER), latency[VICTIMS * NUMBER * 99 / 100],
+         noisy_holds);
+}
+
+int main() {
+  printf("penalty, victim avg ns, victim p99 ns, noisy holds\n");
+  run(false);
+  run(true);
+  return 0;
+}
@@ -0,0 +1,101 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Noisy neighbors on every CPU: one LOW_PRIORITY sandbox per CPU spinning in
+// back to back activities, against a HIGHEST_PRIORITY victim serving short
+// requests with a pause between them. Reported, with placement off and with
+// one CPU reserved for the victim's priority: the victim's average and 99th
+// percentile request latency in us.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include "psandbox.h"
+#include "psandbox_placement.h"
+
+#define NUMBER 2000        // victim requests
+#define REQUEST_WORK 50000 // spins per victim request
+#define NOISY_WORK 1000000 // spins per noisy activity
+#define PAUSE_US 1000
+#define MAX_NOISY 64
+
+static volatile int running;
+static long latency[NUMBER];
+
+static IsolationRule rule_of(int priority) {
+  IsolationRule rule;
+
+  rule.priority = priority;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return rule;
+}
+
+static void spin(int n) {
+  volatile int i;
+  for (i = 0; i < n; i++) {
+  }
+}
+
+static void* do_noisy(void *arg) {
+  int id = create_psandbox(rule_of(LOW_PRIORITY));
+
+  while (running) {
+    activate_psandbox(id);
+    spin(NOISY_WORK);
+    freeze_psandbox(id);
+  }
+  release_psandbox(id);
+  return arg;
+}
+
+static void run(const char *name) {
+  pthread_t noisy[MAX_NOISY];
+  struct timespec start, stop;
+  long total = 0;
+  int i, id, cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus > MAX_NOISY)
+    cpus = MAX_NOISY;
+  running = 1;
+  for (i = 0; i < cpus; i++)
+    pthread_create(&noisy[i], NULL, do_noisy, NULL);
+
+  id = create_psandbox(rule_of(HIGHEST_PRIORITY));
+  for (i = 0; i < NUMBER; i++) {
+    usleep(PAUSE_US);
+    DBUG_TRACE(&start);
+    activate_psandbox(id);
+    spin(REQUEST_WORK);
+    freeze_psandbox(id);
+    DBUG_TRACE(&stop);
+    latency[i] = time2ns(timeDiff(start, stop)) / 1000;
+    total += latency[i];
+  }
+  release_psandbox(id);
+
+  running = 0;
+  for (i = 0; i < cpus; i++)
+    pthread_join(noisy[i], NULL);
+  std::sort(latency, latency + NUMBER);
+  printf("%s, %lu, %lu\n", name, total / NUMBER, latency[NUMBER * 99 / 100]);
+}
+
+int main() {
+  printf("placement, victim avg us, victim p99 us\n");
+  run("off");
+  if (psandbox_placement_enable(1, HIGHEST_PRIORITY)) {
+    printf("reserved, skipped: needs at least 2 cpus\n");
+    return 0;
+  }
+  run("reserved");
+  psandbox_placement_disable();
+  return 0;
+}
@@ -0,0 +1,87 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Connection churn: every thread handles short connections back to back,
+// each in its own sandbox, either created and released per connection or
+// taken from and given back to the sandbox pool. Reported: connections per
+// second at 1 to MAX_THREAD threads.
+
+#include <stdio.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_pool.h"
+
+#define CONNECTIONS 100000  // in total, split across the threads
+#define MAX_THREAD 8
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct benchArg {
+  int use_pool;
+  int connections;
+} BenchArg;
+
+static void* do_handle_one_connection(void* arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  size_t key = (size_t) &session_lock;
+  IsolationRule rule;
+  int i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  for (i = 0; i < bench->connections; i++) {
+    int id = bench->use_pool ? psandbox_pool_get(rule) : create_psandbox(rule);
+
+    activate_psandbox(id);
+    update_psandbox(key, PREPARE);
+    pthread_mutex_lock(&session_lock);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    pthread_mutex_unlock(&session_lock);
+    update_psandbox(key, UNHOLD);
+    freeze_psandbox(id);
+    if (bench->use_pool)
+      psandbox_pool_put(id);
+    else
+      release_psandbox(id);
+  }
+  return 0;
+}
+
+static double run(int threads, int use_pool) {
+  pthread_t tid[MAX_THREAD];
+  struct timespec start, stop;
+  BenchArg arg;
+  int i;
+
+  arg.use_pool = use_pool;
+  arg.connections = CONNECTIONS / threads;
+  DBUG_TRACE(&start);
+  for (i = 0; i < threads; i++)
+    pthread_create(&tid[i], NULL, do_handle_one_connection, &arg);
+  for (i = 0; i < threads; i++)
+    pthread_join(tid[i], NULL);
+  DBUG_TRACE(&stop);
+  return (double) arg.connections * threads * 1e9 /
+      time2ns(timeDiff(start, stop));
+}
+
+int main() {
+  int threads;
+
+  printf("threads, create/release conn/s, pool conn/s\n");
+  for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+    double plain = run(threads, false);
+    double pooled = run(threads, true);
+    printf("%d, %.0f, %.0f\n", threads, plain, pooled);
+  }
+  psandbox_pool_drain();
+  return 0;
+}
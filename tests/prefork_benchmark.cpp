@@ -0,0 +1,76 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A prefork server forking its workers: fork() cost before the library is
+// used, with the library active (SANDBOXES sandboxes in the map and one bound
+// to the forking thread) and a child that exits at once, and with a child
+// that goes on to use its sandbox. Reported: ns in fork() as seen by the
+// parent, and ns until the child is reaped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "psandbox.h"
+
+#define NUMBER 2000
+#define SANDBOXES 1000
+
+enum ChildMode { CHILD_EXIT, CHILD_USE };
+
+static void run(const char *name, int id, enum ChildMode mode) {
+  struct timespec start, forked, reaped;
+  long fork_time = 0, total_time = 0;
+  int i;
+
+  for (i = 0; i < NUMBER; i++) {
+    pid_t child;
+
+    DBUG_TRACE(&start);
+    child = fork();
+    if (child == 0) {
+      if (mode == CHILD_USE) {
+        activate_psandbox(id);
+        update_psandbox((size_t) &start, PREPARE);
+        update_psandbox((size_t) &start, ENTER);
+        freeze_psandbox(id);
+        release_psandbox(id);
+      }
+      _exit(0);
+    }
+    DBUG_TRACE(&forked);
+    waitpid(child, NULL, 0);
+    DBUG_TRACE(&reaped);
+    fork_time += time2ns(timeDiff(start, forked));
+    total_time += time2ns(timeDiff(start, reaped));
+  }
+  printf("%s, %lu, %lu\n", name, fork_time / NUMBER, total_time / NUMBER);
+}
+
+int main() {
+  IsolationRule rule;
+  int i, id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+
+  printf("case, fork ns, fork to reaped ns\n");
+  run("library unused", -1, CHILD_EXIT);
+
+  for (i = 0; i < SANDBOXES; i++) {
+    id = create_psandbox(rule);
+    unbind_psandbox(psandbox_park_key(id), id, UNBIND_NONE);
+  }
+  id = create_psandbox(rule);
+  run("library active, child exits", id, CHILD_EXIT);
+  run("library active, child uses it", id, CHILD_USE);
+  release_psandbox(id);
+  return 0;
+}
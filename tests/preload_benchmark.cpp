@@ -0,0 +1,122 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// The mutex/queue cases with every manual update_psandbox call removed. Run it
+// once as is and once under the interposer to get the instrumentation cost:
+//
+//   ./preload_benchmark
+//   LD_PRELOAD=libpsandbox_preload.so ./preload_benchmark
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "psandbox.h"
+
+#define NUMBER  1000000
+#define THREAD 4
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static sem_t n_active;
+static long counter = 0;
+static int turn = 0;
+
+enum enum_workload { MUTEX, RWLOCK, SEMAPHORE, CONDITION, WORKLOAD_NUM };
+
+static const char *workload_name[WORKLOAD_NUM] = {"mutex", "rwlock",
+                                                  "semaphore", "condition"};
+
+typedef struct workloadArg {
+  enum enum_workload workload;
+  int id;
+} WorkloadArg;
+
+static void* do_handle_one_connection(void* arg) {
+  WorkloadArg *work = (WorkloadArg *) arg;
+  IsolationRule rule;
+  int rounds = work->workload == CONDITION ? NUMBER / 100 : NUMBER;
+  int i, id;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  id = create_psandbox(rule);
+  activate_psandbox(id);
+
+  for (i = 0; i < rounds; i++) {
+    switch (work->workload) {
+      case MUTEX:
+        pthread_mutex_lock(&mutex);
+        counter++;
+        pthread_mutex_unlock(&mutex);
+        break;
+      case RWLOCK:
+        if (i % 16 == 0) {
+          pthread_rwlock_wrlock(&rwlock);
+          counter++;
+        } else {
+          pthread_rwlock_rdlock(&rwlock);
+        }
+        pthread_rwlock_unlock(&rwlock);
+        break;
+      case SEMAPHORE:
+        // srv_conc_enter_innodb with a semaphore instead of sleep-polling
+        sem_wait(&n_active);
+        counter++;
+        sem_post(&n_active);
+        break;
+      case CONDITION:
+        // Ping-pong between threads, every iteration waits at least once.
+        pthread_mutex_lock(&mutex);
+        while (turn % THREAD != work->id) {
+          pthread_cond_wait(&cond, &mutex);
+        }
+        turn++;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        break;
+      default:
+        break;
+    }
+  }
+
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return 0;
+}
+
+int main() {
+  pthread_t threads[THREAD];
+  WorkloadArg arg[THREAD];
+  struct timespec start, stop;
+  int i, j;
+
+  printf("preload, %s\n", getenv("LD_PRELOAD") ? getenv("LD_PRELOAD") : "none");
+  sem_init(&n_active, 0, THREAD / 2);
+  for (j = 0; j < WORKLOAD_NUM; j++) {
+    long ops = (j == CONDITION) ? NUMBER / 100 : NUMBER;
+
+    DBUG_TRACE(&start);
+    for (i = 0; i < THREAD; i++) {
+      arg[i].workload = (enum enum_workload) j;
+      arg[i].id = i;
+      pthread_create(&threads[i], NULL, do_handle_one_connection, &arg[i]);
+    }
+    for (i = 0; i < THREAD; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    DBUG_TRACE(&stop);
+    printf("%s, %lu\n", workload_name[j],
+           time2ns(timeDiff(start, stop)) / (THREAD * ops));
+  }
+  sem_destroy(&n_active);
+  return 0;
+}
@@ -0,0 +1,136 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// The scenario of mutex_predication.cpp as a priority inversion: a
+// LOW_PRIORITY connection holds the mutex in row_search_mysql while
+// MID_PRIORITY connections keep the CPU busy, and a HIGHEST_PRIORITY
+// connection waits for the mutex. All of them share one CPU and run at a
+// nice value matching their priority. Reported: how long the high priority
+// connection waits, with and without priority inheritance.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "psandbox.h"
+
+#define ROUNDS 10
+#define MID_THREADS 2
+#define HOLD_WORK 20000000  // spins in the critical section
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int held;
+static volatile int done;
+
+static void spin(int n) {
+  volatile int i;
+  for (i = 0; i < n; i++) {
+  }
+}
+
+static int start_connection(int priority, int nice) {
+  IsolationRule rule;
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  setpriority(PRIO_PROCESS, 0, nice);
+
+  rule.priority = priority;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return create_psandbox(rule);
+}
+
+static void* do_low(void *arg) {
+  size_t key = (size_t) &mutex;
+  int id = start_connection(LOW_PRIORITY, 10);
+
+  activate_psandbox(id);
+  update_psandbox(key, PREPARE);
+  pthread_mutex_lock(&mutex);
+  update_psandbox(key, ENTER);
+  update_psandbox(key, HOLD);
+  held = 1;
+  spin(HOLD_WORK);
+  pthread_mutex_unlock(&mutex);
+  update_psandbox(key, UNHOLD);
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return arg;
+}
+
+static void* do_mid(void *arg) {
+  int id = start_connection(MID_PRIORITY, 5);
+
+  activate_psandbox(id);
+  while (!done)
+    spin(1000);
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return arg;
+}
+
+static void* do_high(void *arg) {
+  long *wait = (long *) arg;
+  size_t key = (size_t) &mutex;
+  struct timespec start, stop;
+  int id = start_connection(HIGHEST_PRIORITY, 0);
+
+  while (!held)
+    sched_yield();
+  activate_psandbox(id);
+  DBUG_TRACE(&start);
+  update_psandbox(key, PREPARE);
+  pthread_mutex_lock(&mutex);
+  update_psandbox(key, ENTER);
+  DBUG_TRACE(&stop);
+  update_psandbox(key, HOLD);
+  pthread_mutex_unlock(&mutex);
+  update_psandbox(key, UNHOLD);
+  freeze_psandbox(id);
+  release_psandbox(id);
+  *wait = time2ns(timeDiff(start, stop));
+  done = 1;
+  return NULL;
+}
+
+static long run_round() {
+  pthread_t low, high, mid[MID_THREADS];
+  long wait = 0;
+  int i;
+
+  held = 0;
+  done = 0;
+  pthread_create(&low, NULL, do_low, NULL);
+  for (i = 0; i < MID_THREADS; i++)
+    pthread_create(&mid[i], NULL, do_mid, NULL);
+  pthread_create(&high, NULL, do_high, &wait);
+  pthread_join(high, NULL);
+  pthread_join(low, NULL);
+  for (i = 0; i < MID_THREADS; i++)
+    pthread_join(mid[i], NULL);
+  return wait;
+}
+
+int main() {
+  long total;
+  int enable, i;
+
+  printf("inheritance, high priority wait avg us\n");
+  for (enable = 0; enable <= 1; enable++) {
+    psandbox_priority_inheritance(enable);
+    total = 0;
+    for (i = 0; i < ROUNDS; i++)
+      total += run_round();
+    printf("%s, %lu\n", enable ? "on" : "off", total / ROUNDS / 1000);
+  }
+  return 0;
+}
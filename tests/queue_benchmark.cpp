@@ -0,0 +1,158 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// The task queue of ownership_transfer_case_2.cpp (a mutex around
+// linked_list.h, with unbind_psandbox/bind_psandbox around it by hand) vs.
+// psandbox_queue_t, at 1 to 64 producers and as many consumers. Tasks are
+// pushed either without a sandbox (queue cost only) or each in its own
+// sandbox that the consumer releases once done (queue plus handoff).
+
+#include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_queue.h"
+#include "linked_list.h"
+
+#define TASKS 100000  // in total, split across the producers
+#define QUEUE_SIZE 1024
+#define MAX_THREAD 64
+
+static pthread_mutex_t task_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static node_t *task_queue = NULL;
+static int queue_count = 0;
+static psandbox_queue_t lockfree_queue;
+
+typedef struct benchArg {
+  int use_lockfree;
+  int with_psandbox;
+  int tasks;
+} BenchArg;
+
+static void push_to_queue(size_t task) {
+  for (;;) {
+    pthread_mutex_lock(&task_queue_lock);
+    if (queue_count < QUEUE_SIZE) {
+      task_queue = queue_push(task_queue, task);
+      queue_count++;
+      pthread_mutex_unlock(&task_queue_lock);
+      return;
+    }
+    pthread_mutex_unlock(&task_queue_lock);
+    sched_yield();
+  }
+}
+
+static size_t pop_from_queue() {
+  size_t task;
+
+  for (;;) {
+    pthread_mutex_lock(&task_queue_lock);
+    if (queue_count > 0) {
+      task = task_queue->data;
+      task_queue = queue_pop(task_queue);
+      queue_count--;
+      pthread_mutex_unlock(&task_queue_lock);
+      return task;
+    }
+    pthread_mutex_unlock(&task_queue_lock);
+    sched_yield();
+  }
+}
+
+static void* do_produce(void* arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  IsolationRule rule;
+  int i;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+
+  // The task is the id of its sandbox, which also serves as the unbind key
+  // of the linked list version.
+  for (i = 0; i < bench->tasks; i++) {
+    long id = bench->with_psandbox ? create_psandbox(rule) : -1;
+
+    if (bench->use_lockfree) {
+      while (psandbox_queue_push(&lockfree_queue, (void *) id) != 0) {
+        sched_yield();
+      }
+    } else {
+      if (id != -1)
+        unbind_psandbox(id, id, UNBIND_NONE);
+      push_to_queue(id);
+    }
+  }
+  return 0;
+}
+
+static void* do_consume(void* arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  int i;
+
+  for (i = 0; i < bench->tasks; i++) {
+    void *data;
+    long id;
+
+    if (bench->use_lockfree) {
+      while (psandbox_queue_pop(&lockfree_queue, &data) != 0) {
+        sched_yield();
+      }
+      id = (long) data;
+    } else {
+      id = (long) pop_from_queue();
+      if (id != -1)
+        bind_psandbox(id);
+    }
+    if (id != -1)
+      release_psandbox(id);
+  }
+  return 0;
+}
+
+static long run(int threads, int use_lockfree, int with_psandbox) {
+  pthread_t producer[MAX_THREAD], consumer[MAX_THREAD];
+  struct timespec start, stop;
+  BenchArg arg;
+  int i;
+
+  arg.use_lockfree = use_lockfree;
+  arg.with_psandbox = with_psandbox;
+  arg.tasks = TASKS / threads;
+  DBUG_TRACE(&start);
+  for (i = 0; i < threads; i++) {
+    pthread_create(&consumer[i], NULL, do_consume, &arg);
+    pthread_create(&producer[i], NULL, do_produce, &arg);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(producer[i], NULL);
+    pthread_join(consumer[i], NULL);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / ((long) arg.tasks * threads);
+}
+
+int main() {
+  int threads;
+
+  psandbox_queue_init(&lockfree_queue, QUEUE_SIZE);
+  printf("threads, mutex list ns/task, lock-free ns/task, "
+         "mutex list + handoff ns/task, lock-free + handoff ns/task\n");
+  for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+    long list = run(threads, false, false);
+    long lockfree = run(threads, true, false);
+    long list_handoff = run(threads, false, true);
+    long lockfree_handoff = run(threads, true, true);
+    printf("%d, %lu, %lu, %lu, %lu\n", threads, list, lockfree, list_handoff,
+           lockfree_handoff);
+  }
+  psandbox_queue_destroy(&lockfree_queue);
+  return 0;
+}
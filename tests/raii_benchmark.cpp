@@ -0,0 +1,147 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// Hand-written C calls vs. the psandbox.hpp wrappers doing the same work: a
+// reported pthread mutex critical section, the same with NullPolicy against
+// a bare lock/unlock, and a full create/activate/freeze/release cycle. The
+// two columns of each row should match.
+
+#include <stdio.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox.hpp"
+
+#define NUMBER 1000000
+#define LIFECYCLE_NUMBER 100000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile long counter = 0;
+
+static IsolationRule make_rule() {
+  IsolationRule rule;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return rule;
+}
+
+static long hold_c() {
+  struct timespec start, stop;
+  size_t key = (size_t) &mutex;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    update_psandbox(key, PREPARE);
+    pthread_mutex_lock(&mutex);
+    update_psandbox(key, ENTER);
+    update_psandbox(key, HOLD);
+    counter++;
+    pthread_mutex_unlock(&mutex);
+    update_psandbox(key, UNHOLD);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / NUMBER;
+}
+
+static long hold_cpp() {
+  struct timespec start, stop;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    psandbox::ScopedHold<pthread_mutex_t, psandbox::KernelPolicy> hold(mutex);
+    counter++;
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / NUMBER;
+}
+
+static long bare_c() {
+  struct timespec start, stop;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    pthread_mutex_lock(&mutex);
+    counter++;
+    pthread_mutex_unlock(&mutex);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / NUMBER;
+}
+
+static long bare_cpp() {
+  struct timespec start, stop;
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < NUMBER; i++) {
+    psandbox::ScopedHold<pthread_mutex_t, psandbox::NullPolicy> hold(mutex);
+    counter++;
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / NUMBER;
+}
+
+static long lifecycle_c() {
+  struct timespec start, stop;
+  IsolationRule rule = make_rule();
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < LIFECYCLE_NUMBER; i++) {
+    int id = create_psandbox(rule);
+
+    activate_psandbox(id);
+    counter++;
+    freeze_psandbox(id);
+    release_psandbox(id);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / LIFECYCLE_NUMBER;
+}
+
+static long lifecycle_cpp() {
+  struct timespec start, stop;
+  IsolationRule rule = make_rule();
+  int i;
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < LIFECYCLE_NUMBER; i++) {
+    psandbox::SandboxHandle<psandbox::KernelPolicy> sandbox(rule);
+    psandbox::ScopedActivation<psandbox::KernelPolicy> activation(sandbox);
+    counter++;
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / LIFECYCLE_NUMBER;
+}
+
+int main() {
+  IsolationRule rule = make_rule();
+  int id = create_psandbox(rule);
+  long c, cpp;
+
+  printf("case, C ns/op, C++ ns/op\n");
+  activate_psandbox(id);
+  c = hold_c();
+  cpp = hold_cpp();
+  printf("reported mutex, %lu, %lu\n", c, cpp);
+  c = bare_c();
+  cpp = bare_cpp();
+  printf("bare mutex (NullPolicy), %lu, %lu\n", c, cpp);
+  freeze_psandbox(id);
+  release_psandbox(id);
+
+  c = lifecycle_c();
+  cpp = lifecycle_cpp();
+  printf("create/activate/freeze/release, %lu, %lu\n", c, cpp);
+  return 0;
+}
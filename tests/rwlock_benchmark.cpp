@@ -0,0 +1,185 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// psandbox_rwlock_t against pthread_rwlock_t. First a check that readers and
+// writers exclude each other and that the try variants fail while the lock is
+// taken the other way, then a read-mostly load: every thread, in its own
+// sandbox, reads a shared pair of counters and writes it once every
+// write_every operations. Reported: ns per operation.
+
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_rwlock.h"
+
+#define NUMBER  1000000
+#define CHECK_NUMBER 100000
+#define MAX_THREAD 8
+
+static pthread_rwlock_t raw_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static psandbox_rwlock_t box_rwlock = PSANDBOX_RWLOCK_INITIALIZER;
+static volatile long first = 0, second = 0;
+static int readers_inside = 0, writers_inside = 0, violations = 0;
+
+typedef struct benchArg {
+  int use_psandbox;
+  int write_every;
+} BenchArg;
+
+static IsolationRule default_rule() {
+  IsolationRule rule;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return rule;
+}
+
+static void* do_check(void* arg) {
+  long i, writer = (long) arg;
+  int id = create_psandbox(default_rule());
+
+  activate_psandbox(id);
+  for (i = 0; i < CHECK_NUMBER; i++) {
+    if (writer && i % 4 == 0) {
+      psandbox_rwlock_wrlock(&box_rwlock);
+      if (__atomic_add_fetch(&writers_inside, 1, __ATOMIC_SEQ_CST) != 1 ||
+          __atomic_load_n(&readers_inside, __ATOMIC_SEQ_CST))
+        __atomic_add_fetch(&violations, 1, __ATOMIC_RELAXED);
+      first++;
+      second++;
+      __atomic_sub_fetch(&writers_inside, 1, __ATOMIC_SEQ_CST);
+      psandbox_rwlock_wrunlock(&box_rwlock);
+    } else {
+      psandbox_rwlock_rdlock(&box_rwlock);
+      __atomic_add_fetch(&readers_inside, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&writers_inside, __ATOMIC_SEQ_CST) ||
+          first != second)
+        __atomic_add_fetch(&violations, 1, __ATOMIC_RELAXED);
+      __atomic_sub_fetch(&readers_inside, 1, __ATOMIC_SEQ_CST);
+      psandbox_rwlock_rdunlock(&box_rwlock);
+    }
+  }
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return 0;
+}
+
+/// @return 0 if readers and writers never overlapped, -1 otherwise
+static int check_exclusion() {
+  pthread_t thread[MAX_THREAD];
+  long i;
+
+  for (i = 0; i < MAX_THREAD; i++) {
+    pthread_create(&thread[i], NULL, do_check, (void *) (i % 2));
+  }
+  for (i = 0; i < MAX_THREAD; i++) {
+    pthread_join(thread[i], NULL);
+  }
+  if (violations || first != CHECK_NUMBER / 4 * (MAX_THREAD / 2))
+    return -1;
+
+  psandbox_rwlock_rdlock(&box_rwlock);
+  if (psandbox_rwlock_trywrlock(&box_rwlock) != EBUSY)
+    return -1;
+  if (psandbox_rwlock_tryrdlock(&box_rwlock))
+    return -1;
+  psandbox_rwlock_rdunlock(&box_rwlock);
+  psandbox_rwlock_rdunlock(&box_rwlock);
+  psandbox_rwlock_wrlock(&box_rwlock);
+  if (psandbox_rwlock_tryrdlock(&box_rwlock) != EBUSY ||
+      psandbox_rwlock_trywrlock(&box_rwlock) != EBUSY)
+    return -1;
+  psandbox_rwlock_wrunlock(&box_rwlock);
+  if (psandbox_rwlock_trywrlock(&box_rwlock))
+    return -1;
+  psandbox_rwlock_wrunlock(&box_rwlock);
+  return 0;
+}
+
+static void* do_handle_one_connection(void* arg) {
+  BenchArg *bench = (BenchArg *) arg;
+  volatile long sum = 0;
+  int i, id;
+
+  id = create_psandbox(default_rule());
+  activate_psandbox(id);
+
+  for (i = 0; i < NUMBER; i++) {
+    int write = bench->write_every && i % bench->write_every == 0;
+
+    if (bench->use_psandbox) {
+      if (write) {
+        psandbox_rwlock_wrlock(&box_rwlock);
+        first++;
+        second++;
+        psandbox_rwlock_wrunlock(&box_rwlock);
+      } else {
+        psandbox_rwlock_rdlock(&box_rwlock);
+        sum += first + second;
+        psandbox_rwlock_rdunlock(&box_rwlock);
+      }
+    } else {
+      if (write) {
+        pthread_rwlock_wrlock(&raw_rwlock);
+        first++;
+        second++;
+        pthread_rwlock_unlock(&raw_rwlock);
+      } else {
+        pthread_rwlock_rdlock(&raw_rwlock);
+        sum += first + second;
+        pthread_rwlock_unlock(&raw_rwlock);
+      }
+    }
+  }
+
+  freeze_psandbox(id);
+  release_psandbox(id);
+  return 0;
+}
+
+static long run(int threads, int use_psandbox, int write_every) {
+  pthread_t thread[MAX_THREAD];
+  BenchArg arg;
+  struct timespec start, stop;
+  int i;
+
+  arg.use_psandbox = use_psandbox;
+  arg.write_every = write_every;
+  DBUG_TRACE(&start);
+  for (i = 0; i < threads; i++) {
+    pthread_create(&thread[i], NULL, do_handle_one_connection, &arg);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(thread[i], NULL);
+  }
+  DBUG_TRACE(&stop);
+  return time2ns(timeDiff(start, stop)) / ((long) threads * NUMBER);
+}
+
+int main() {
+  int write_every[] = {0, 1000, 10};
+  int threads, j;
+
+  if (check_exclusion()) {
+    printf("readers and writers of psandbox_rwlock_t overlapped\n");
+    return 1;
+  }
+
+  printf("threads, write every, pthread ns/op, psandbox ns/op\n");
+  for (threads = 1; threads <= MAX_THREAD; threads *= 2) {
+    for (j = 0; j < (int) (sizeof(write_every) / sizeof(write_every[0])); j++) {
+      long raw = run(threads, false, write_every[j]);
+      long box = run(threads, true, write_every[j]);
+      printf("%d, %d, %lu, %lu\n", threads, write_every[j], raw, box);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,167 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A proxy process passing requests to a worker process over a Unix socket:
+// the bare round trip, the proxy creating the sandbox and handing it to the
+// worker through the shared registry, and the worker creating its own
+// sandbox. Reported: average and 99th percentile round trip in ns. Checked
+// first: a thread that handed its sandbox off has none to HOLD keys in.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include "psandbox.h"
+#include "psandbox_shared.h"
+
+#define NUMBER 20000
+#define REGISTRY "/psandbox_handoff_benchmark"
+#define CAPACITY 1024
+
+enum Mode { MODE_SOCKET, MODE_HANDOFF, MODE_WORKER_CREATES, MODE_EXIT };
+
+typedef struct request {
+  int mode;
+  uint64_t token;
+} Request;
+
+static long latency[NUMBER];
+
+static IsolationRule default_rule() {
+  IsolationRule rule;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  return rule;
+}
+
+static void serve(int id) {
+  struct timespec now;
+
+  activate_psandbox(id);
+  update_psandbox((size_t) &now, PREPARE);
+  update_psandbox((size_t) &now, ENTER);
+  freeze_psandbox(id);
+}
+
+static void worker(int sock) {
+  Request request;
+  int id;
+
+  psandbox_registry_open(REGISTRY, CAPACITY);
+  while (read(sock, &request, sizeof(request)) == sizeof(request)) {
+    switch (request.mode) {
+      case MODE_HANDOFF:
+        id = psandbox_handoff_bind(request.token);
+        if (id != -1) {
+          serve(id);
+          psandbox_registry_remove(id);
+          release_psandbox(id);
+        }
+        break;
+      case MODE_WORKER_CREATES:
+        id = create_psandbox(default_rule());
+        serve(id);
+        release_psandbox(id);
+        break;
+      case MODE_EXIT:
+        fflush(stdout);
+        _exit(0);
+    }
+    write(sock, &request.mode, sizeof(request.mode));
+  }
+  _exit(1);
+}
+
+static int check_handoff_hold() {
+  size_t key = (size_t) &latency;
+  uint64_t token;
+  int id = create_psandbox(default_rule());
+
+  if (id == -1 || psandbox_registry_add(id))
+    return -1;
+  token = psandbox_handoff_unbind(id);
+  if (!token)
+    return -1;
+  if (update_psandbox(key, HOLD) != -1 || update_psandbox(key, UNHOLD) != -1)
+    return -1;
+  id = psandbox_handoff_bind(token);
+  if (id == -1)
+    return -1;
+  psandbox_registry_remove(id);
+  release_psandbox(id);
+  return 0;
+}
+
+static void run(const char *name, int sock, enum Mode mode) {
+  struct timespec start, stop;
+  Request request;
+  long total = 0;
+  int i, reply;
+
+  request.mode = mode;
+  request.token = 0;
+  for (i = 0; i < NUMBER; i++) {
+    DBUG_TRACE(&start);
+    if (mode == MODE_HANDOFF) {
+      int id = create_psandbox(default_rule());
+
+      psandbox_registry_add(id);
+      request.token = psandbox_handoff_unbind(id);
+    }
+    write(sock, &request, sizeof(request));
+    read(sock, &reply, sizeof(reply));
+    DBUG_TRACE(&stop);
+    latency[i] = time2ns(timeDiff(start, stop));
+    total += latency[i];
+  }
+  std::sort(latency, latency + NUMBER);
+  printf("%s, %lu, %lu\n", name, total / NUMBER, latency[NUMBER * 99 / 100]);
+}
+
+int main() {
+  Request request;
+  int sock[2];
+  pid_t child;
+
+  psandbox_registry_close(REGISTRY, 1);
+  if (psandbox_registry_open(REGISTRY, CAPACITY)) {
+    printf("can't create the registry\n");
+    return 1;
+  }
+  if (check_handoff_hold()) {
+    printf("a sandbox handed off is still used by the thread\n");
+    return 1;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock)) {
+    printf("can't create the socket\n");
+    return 1;
+  }
+  child = fork();
+  if (child == 0) {
+    close(sock[0]);
+    worker(sock[1]);
+  }
+  close(sock[1]);
+
+  printf("case, avg ns, p99 ns\n");
+  run("socket round trip", sock[0], MODE_SOCKET);
+  run("proxy creates, hands off", sock[0], MODE_HANDOFF);
+  run("worker creates", sock[0], MODE_WORKER_CREATES);
+
+  request.mode = MODE_EXIT;
+  write(sock[0], &request, sizeof(request));
+  waitpid(child, NULL, 0);
+  psandbox_registry_close(REGISTRY, 1);
+  return 0;
+}
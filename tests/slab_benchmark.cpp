@@ -0,0 +1,108 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// CYCLES create_psandbox/release_psandbox cycles, in batches of BATCH live
+// sandboxes. Reported: the average cost of a create and a release, the cost
+// of the slab allocation and free alone and their share of it, calloc/free
+// of a PSandbox for comparison, and the resident set size before and after
+// all the cycles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "psandbox.h"
+#include "../libs/src/psandbox_slab.h"
+
+#define CYCLES 10000000
+#define BATCH 1000
+
+static int ids[BATCH];
+static void *objects[BATCH];
+
+static long rss_kb() {
+  long size, resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+
+  if (file) {
+    if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+      resident = 0;
+    fclose(file);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long elapsed(struct timespec *start, struct timespec *stop) {
+  return time2ns(timeDiff(*start, *stop));
+}
+
+int main() {
+  struct timespec start, stop;
+  IsolationRule rule;
+  long create = 0, release = 0, alloc = 0, free_ns = 0, slabs, in_use;
+  long rss_before, rss_after;
+  int i, j;
+
+  rule.priority = 0;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+
+  rss_before = rss_kb();
+  for (i = 0; i < CYCLES / BATCH; i++) {
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      ids[j] = create_psandbox(rule);
+    DBUG_TRACE(&stop);
+    create += elapsed(&start, &stop);
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      release_psandbox(ids[j]);
+    DBUG_TRACE(&stop);
+    release += elapsed(&start, &stop);
+  }
+  rss_after = rss_kb();
+  slab_stats(&slabs, &in_use);
+
+  for (i = 0; i < CYCLES / BATCH; i++) {
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      objects[j] = slab_alloc();
+    DBUG_TRACE(&stop);
+    alloc += elapsed(&start, &stop);
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      slab_free((PSandbox *) objects[j]);
+    DBUG_TRACE(&stop);
+    free_ns += elapsed(&start, &stop);
+  }
+
+  printf("operation, create ns, release ns\n");
+  printf("create/release, %ld, %ld\n", create / CYCLES, release / CYCLES);
+  printf("slab alloc/free, %ld, %ld\n", alloc / CYCLES, free_ns / CYCLES);
+  printf("allocator share %%, %ld, %ld\n", alloc * 100 / create,
+         free_ns * 100 / release);
+
+  alloc = free_ns = 0;
+  for (i = 0; i < CYCLES / BATCH; i++) {
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      objects[j] = calloc(1, sizeof(PSandbox));
+    DBUG_TRACE(&stop);
+    alloc += elapsed(&start, &stop);
+    DBUG_TRACE(&start);
+    for (j = 0; j < BATCH; j++)
+      free(objects[j]);
+    DBUG_TRACE(&stop);
+    free_ns += elapsed(&start, &stop);
+  }
+  printf("calloc/free, %ld, %ld\n", alloc / CYCLES, free_ns / CYCLES);
+
+  printf("rss before KB, rss after KB, slabs, sandboxes in use\n");
+  printf("%ld, %ld, %ld, %ld\n", rss_before, rss_after, slabs, in_use);
+  return 0;
+}
@@ -0,0 +1,72 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A simulated workload for the SLO controller. Two classes with a 2ms p99
+// SLO: "victim" requests take 0.5ms and suffer interference from a noisy
+// neighbor that grows with their isolation_level, until the neighbor goes
+// away at round NOISY_ROUNDS; "heavy" requests take 2.5ms by themselves,
+// which no isolation can fix. Reported per round: each class's level and
+// the 99th percentile latency it saw in us.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "psandbox.h"
+#include "psandbox_slo.h"
+
+#define ROUNDS 60
+#define NOISY_ROUNDS 30
+#define SAMPLES 512  // per class and round
+#define SLO_NS 2000000L
+
+static long latency[SAMPLES];
+static unsigned int seed = 1;
+
+static double uniform() {
+  return (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+/// @return The class's 99th percentile latency over the round
+static long simulate(int slo_class, long service, long noisy_mean) {
+  int i;
+
+  for (i = 0; i < SAMPLES; i++) {
+    int level = psandbox_slo_rule(slo_class).isolation_level;
+    long interference =
+        (long) (2 * uniform() * uniform() * noisy_mean * level / 100);
+
+    latency[i] = (long) (service * (0.9 + 0.2 * uniform())) + interference;
+    psandbox_slo_observe(slo_class, latency[i], interference);
+  }
+  std::sort(latency, latency + SAMPLES);
+  return latency[SAMPLES * 99 / 100];
+}
+
+int main() {
+  IsolationRule rule;
+  int victim, heavy, round;
+
+  rule.priority = 0;
+  rule.isolation_level = 100;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  victim = psandbox_slo_class(rule, SLO_NS, 5, 100);
+  heavy = psandbox_slo_class(rule, SLO_NS, 5, 100);
+
+  printf("round, victim level, victim p99 us, heavy level, heavy p99 us\n");
+  for (round = 0; round < ROUNDS; round++) {
+    long noisy = round < NOISY_ROUNDS ? 3000000 : 0;
+    long victim_p99 = simulate(victim, 500000, noisy);
+    long heavy_p99 = simulate(heavy, 2500000, 0);
+
+    printf("%d, %d, %lu, %d, %lu\n", round,
+           psandbox_slo_rule(victim).isolation_level, victim_p99 / 1000,
+           psandbox_slo_rule(heavy).isolation_level, heavy_p99 / 1000);
+  }
+  return 0;
+}
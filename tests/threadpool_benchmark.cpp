@@ -0,0 +1,238 @@
+//
+// The Psandbox project
+//
+// Copyright (c) 2021, Johns Hopkins University - Order Lab
+//
+//      All rights reserved.
+//      Licensed under the Apache License, Version 2.0 (the "License");
+
+// A thread-pool server as in the ownership_transfer cases: connections hand
+// each request to a pool and wait for the reply. A request runs as a task
+// plus a continuation it submits itself. The plain pool is a mutex/cond FIFO
+// whose workers bind and unbind the sandbox around every task by hand;
+// psandbox_threadpool_t moves the sandbox itself. Half of the connections
+// run in HIGHEST_PRIORITY sandboxes; latency is reported per class.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "psandbox.h"
+#include "psandbox_threadpool.h"
+
+#define WORKERS 4
+#define CONNECTIONS 16
+#define REQUESTS 2000
+#define WORK_NS 20000
+
+typedef struct request {
+  int psandbox;
+  int use_psandbox_pool;
+  int done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Request;
+
+typedef struct plainTask {
+  struct plainTask *next;
+  void (*fn)(void *);
+  void *arg;
+  int psandbox;
+} PlainTask;
+
+typedef struct connectionArg {
+  int use_psandbox_pool;
+  int priority;
+  long latency;      // total request latency
+  long max_latency;
+} ConnectionArg;
+
+static psandbox_threadpool_t psandbox_pool;
+
+static pthread_mutex_t plain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t plain_cond = PTHREAD_COND_INITIALIZER;
+static PlainTask *plain_head = NULL, *plain_tail = NULL;
+static int plain_stop = 0;
+
+static void plain_submit(void (*fn)(void *), void *arg, int psandbox) {
+  PlainTask *task = (PlainTask *) malloc(sizeof(PlainTask));
+
+  task->next = NULL;
+  task->fn = fn;
+  task->arg = arg;
+  task->psandbox = psandbox;
+  pthread_mutex_lock(&plain_lock);
+  if (plain_tail)
+    plain_tail->next = task;
+  else
+    plain_head = task;
+  plain_tail = task;
+  pthread_cond_signal(&plain_cond);
+  pthread_mutex_unlock(&plain_lock);
+}
+
+static void* plain_worker(void *) {
+  for (;;) {
+    PlainTask *task;
+
+    pthread_mutex_lock(&plain_lock);
+    while (!plain_head && !plain_stop)
+      pthread_cond_wait(&plain_cond, &plain_lock);
+    task = plain_head;
+    if (!task) {
+      pthread_mutex_unlock(&plain_lock);
+      return 0;
+    }
+    plain_head = task->next;
+    if (!plain_head)
+      plain_tail = NULL;
+    pthread_mutex_unlock(&plain_lock);
+
+    if (task->psandbox)
+      bind_psandbox(psandbox_park_key(task->psandbox));
+    task->fn(task->arg);
+    if (task->psandbox)
+      unbind_psandbox(psandbox_park_key(task->psandbox), task->psandbox,
+                      UNBIND_NONE);
+    free(task);
+  }
+}
+
+static void spin(long ns) {
+  struct timespec start, now;
+
+  DBUG_TRACE(&start);
+  do {
+    DBUG_TRACE(&now);
+  } while (time2ns(timeDiff(start, now)) < ns);
+}
+
+static void finish_request(void *arg) {
+  Request *request = (Request *) arg;
+
+  spin(WORK_NS);
+  pthread_mutex_lock(&request->lock);
+  request->done = 1;
+  pthread_cond_signal(&request->cond);
+  pthread_mutex_unlock(&request->lock);
+}
+
+static void start_request(void *arg) {
+  Request *request = (Request *) arg;
+
+  spin(WORK_NS);
+  if (request->use_psandbox_pool)
+    psandbox_threadpool_submit(&psandbox_pool, finish_request, request);
+  else
+    plain_submit(finish_request, request, request->psandbox);
+}
+
+static void* do_connection(void *arg) {
+  ConnectionArg *connection = (ConnectionArg *) arg;
+  IsolationRule rule;
+  Request request;
+  int i;
+
+  rule.priority = connection->priority;
+  rule.isolation_level = 50;
+  rule.type = RELATIVE;
+  rule.is_retro = false;
+  pthread_mutex_init(&request.lock, NULL);
+  pthread_cond_init(&request.cond, NULL);
+  request.use_psandbox_pool = connection->use_psandbox_pool;
+
+  for (i = 0; i < REQUESTS; i++) {
+    struct timespec start, stop;
+    long latency;
+    int id = create_psandbox(rule);
+
+    DBUG_TRACE(&start);
+    activate_psandbox(id);
+    request.psandbox = id;
+    request.done = 0;
+    if (connection->use_psandbox_pool) {
+      psandbox_threadpool_submit(&psandbox_pool, start_request, &request);
+    } else {
+      unbind_psandbox(psandbox_park_key(id), id, UNBIND_NONE);
+      plain_submit(start_request, &request, id);
+    }
+
+    pthread_mutex_lock(&request.lock);
+    while (!request.done)
+      pthread_cond_wait(&request.cond, &request.lock);
+    pthread_mutex_unlock(&request.lock);
+
+    bind_psandbox(psandbox_park_key(id));
+    freeze_psandbox(id);
+    DBUG_TRACE(&stop);
+    release_psandbox(id);
+
+    latency = time2ns(timeDiff(start, stop));
+    connection->latency += latency;
+    if (latency > connection->max_latency)
+      connection->max_latency = latency;
+  }
+  pthread_cond_destroy(&request.cond);
+  pthread_mutex_destroy(&request.lock);
+  return 0;
+}
+
+static void run(int use_psandbox_pool) {
+  pthread_t workers[WORKERS], connections[CONNECTIONS];
+  ConnectionArg args[CONNECTIONS];
+  struct timespec start, stop;
+  long latency[2] = {0, 0}, max_latency[2] = {0, 0};
+  long total;
+  int i;
+
+  if (use_psandbox_pool) {
+    psandbox_threadpool_init(&psandbox_pool, WORKERS);
+  } else {
+    plain_stop = 0;
+    for (i = 0; i < WORKERS; i++)
+      pthread_create(&workers[i], NULL, plain_worker, NULL);
+  }
+
+  DBUG_TRACE(&start);
+  for (i = 0; i < CONNECTIONS; i++) {
+    args[i].use_psandbox_pool = use_psandbox_pool;
+    args[i].priority = i % 2 ? HIGHEST_PRIORITY : LOW_PRIORITY;
+    args[i].latency = 0;
+    args[i].max_latency = 0;
+    pthread_create(&connections[i], NULL, do_connection, &args[i]);
+  }
+  for (i = 0; i < CONNECTIONS; i++) {
+    int high = args[i].priority == HIGHEST_PRIORITY;
+
+    pthread_join(connections[i], NULL);
+    latency[high] += args[i].latency;
+    if (args[i].max_latency > max_latency[high])
+      max_latency[high] = args[i].max_latency;
+  }
+  DBUG_TRACE(&stop);
+
+  if (use_psandbox_pool) {
+    psandbox_threadpool_destroy(&psandbox_pool);
+  } else {
+    pthread_mutex_lock(&plain_lock);
+    plain_stop = 1;
+    pthread_cond_broadcast(&plain_cond);
+    pthread_mutex_unlock(&plain_lock);
+    for (i = 0; i < WORKERS; i++)
+      pthread_join(workers[i], NULL);
+  }
+
+  total = (long) CONNECTIONS * REQUESTS;
+  printf("%s, %.0f, %lu, %lu, %lu, %lu\n",
+         use_psandbox_pool ? "psandbox pool" : "plain pool",
+         total * 1e9 / time2ns(timeDiff(start, stop)),
+         latency[1] / (total / 2), max_latency[1],
+         latency[0] / (total / 2), max_latency[0]);
+}
+
+int main() {
+  printf("pool, requests/s, high avg ns, high max ns, low avg ns, "
+         "low max ns\n");
+  run(false);
+  run(true);
+  return 0;
+}